@@ -11,6 +11,61 @@ define('SYSLOG', LOG_LOCAL0);
 // be set to this directory
 define('CREATE_WRITABLE_TEMP_DIR', getenv('DOMJUDGE_CREATE_WRITABLE_TEMP_DIR') ? true : false);
 
+// Run the output validator concurrently with the submission and feed it
+// the output of the submission while it is being produced. As soon as the
+// validator rejects the output, the submission is stopped, instead of
+// waiting for it to finish or run into the timelimit. Only applies to
+// problems without a combined run and compare script. Note that the
+// validator then runs at the same time (and on the same CPU) as the
+// submission, and needs read access to the cached test answers. The
+// validator runs as the user '<runuser>-validator' (e.g.
+// 'domjudge-run-2-validator' for judgedaemon -n 2), which must be created
+// like the runuser, so that the submission cannot interfere with it;
+// without that user, this option is ignored.
+define('STREAM_COMPARE', getenv('DOMJUDGE_STREAM_COMPARE') ? true : false);
+
+// Have the output validator build an index of each new test answer, which
+// it can then use instead of parsing the answer for every submission. The
+// index is stored next to the cached answer as '<hash>.out.idx'. This runs
+// the validator as '<validator> --build-index <answer>', which only the
+// default output validator supports. A validator that does not write a
+// valid index this way is not asked again until the judgedaemon restarts.
+define('ANSWER_INDEX', getenv('DOMJUDGE_ANSWER_INDEX') ? true : false);
+
+// Reclaim the page cache that a submission's run created by writing to
+// memory.reclaim of its cgroup before runguard removes it (requires Linux
+// 5.19 or newer). The amount reclaimed is recorded as 'cache-reclaimed-bytes'
+// in the run metadata. This frees the file pages of each run right away,
+// instead of when the judging is cleaned up; the judging directory is then
+// still evicted, as files written by the judgedaemon itself are not charged
+// to the cgroups of the runs.
+define('CGROUP_RECLAIM', getenv('DOMJUDGE_CGROUP_RECLAIM') ? true : false);
+
+// Keep output validators that support it running between testcases, instead
+// of starting a new validator process for every testcase. A validator
+// supports this when it is built with run_validator() from validate.h; it is
+// then started once as '<validator> --resident' under runguard with the
+// memory and file size limits of the problem, and is sent the testcases over
+// a pipe. Each testcase must be checked within the script timelimit, but
+// there is no CPU time limit over all testcases. Like for STREAM_COMPARE,
+// it runs as the user '<runuser>-validator' if that exists, since it stays
+// running while the submissions run; otherwise as the runuser. The CPU time
+// and memory in the compare metadata are then those of the check of the
+// testcase as reported by the validator. Validators without support
+// are run as before. Does not apply to streaming compares (STREAM_COMPARE)
+// and combined run and compare scripts.
+define('RESIDENT_VALIDATOR', getenv('DOMJUDGE_RESIDENT_VALIDATOR') ? true : false);
+
+// Fork the process of the submission for each testcase from a zygote: a
+// process of the language runtime started once per judging that has already
+// initialized itself, instead of starting the runtime for every testcase.
+// This only applies to executables whose compile step generated a 'zygote'
+// program (of the default ones only 'py3'). The zygote runs under runguard
+// with the restrictions of the submission, and the time of the submission is
+// charged from the fork. Memory used by the runtime before the fork is not
+// charged to the submission. Not used with CREATE_WRITABLE_TEMP_DIR.
+define('ZYGOTE', getenv('DOMJUDGE_ZYGOTE') ? true : false);
+
 // These define HTTP request backoff related constants.
 // If any transient network error occurs on the nth trial,
 // the judgehost retries the HTTP request after pow(factor, trial - 1) + rand(0, jitter) sec.
@@ -16,6 +16,32 @@
  *        std::istream objects for judge input file, judge answer
  *        file, and submission output file.
  *
+ * - judge_in_reader, judge_ans_reader, author_out_reader:
+ *        input_reader objects for the same files, for fast reading of
+ *        large inputs. A file should be read either through its
+ *        istream or through its input_reader, not both. Files are
+ *        mapped into memory where possible, otherwise read in large
+ *        blocks, so this also works for interactive problems. Reading
+ *        functions:
+ *          read_token()  next whitespace separated token, as a
+ *                        std::string_view that is valid until the next
+ *                        call on the same reader
+ *          read_int()    next token as a long long, optionally with
+ *                        read_int(min, max) to check the range
+ *          read_double() next token as a finite double
+ *          at_eof()      whether there are no more tokens
+ *          line()        line number of the last token read
+ *        When the input does not match, this gives Wrong Answer for
+ *        the submission output and Judge Error for the judge files,
+ *        with a message that includes the line number.
+ *
+ * - run_validator(argc, argv, check):
+ *        calls init_io(argc, argv) and then check(argc, argv), which
+ *        should end with accept(), accept_with_score() or
+ *        wrong_answer(); returning from it means accepted. Validators
+ *        written this way can also run as a resident validator, see
+ *        below.
+ *
  * - accept():
  *        exit and give Accepted!
  *
@@ -43,16 +69,51 @@
  *        submission).  (Use with caution, and be careful not to let
  *        it leak information!)
  *
+ * Resident validators
+ *
+ * A validator using run_validator() that is started with the single
+ * argument "--resident" stays running and checks many testcases, so
+ * that data that it loads once (e.g. at static initialization, or
+ * cached by check() between calls) does not have to be loaded again for
+ * every testcase. It writes the line "DOMJUDGE-RESIDENT 1" to stdout
+ * and then reads requests from stdin. Each request is a line with the
+ * length in bytes of the payload, followed by the payload: NUL
+ * separated arguments, which are the files to write stdout and stderr
+ * to, judge input, judge answer, feedback directory, the file with the
+ * submission output, and any further validator arguments. For each
+ * request, stdin, stdout and stderr are set up as for a validator
+ * process, check() is called, and a line is written to stdout with the
+ * exit code it would have had, the CPU time in seconds used by the check
+ * and the peak memory in bytes during the check, separated by spaces. If
+ * the peak memory cannot be reset between checks, it is that of the whole
+ * process instead. The validator exits at end of file.
+ * In resident mode, accept() and the like throw an exception to return
+ * from check(), so check() must not catch all exceptions.
  */
 #pragma once
 
+#include <sys/mman.h>
+#include <sys/prctl.h>
+#include <sys/resource.h>
 #include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdio_ext.h>
+#include <algorithm>
 #include <cassert>
+#include <cerrno>
+#include <charconv>
+#include <cmath>
 #include <cstdarg>
+#include <cstdio>
 #include <cstdlib>
+#include <cstring>
 #include <iostream>
 #include <fstream>
 #include <sstream>
+#include <string>
+#include <string_view>
+#include <vector>
 
 typedef void (*feedback_function)(const std::string &, ...);
 
@@ -70,6 +131,21 @@ std::istream author_out(std::cin.rdbuf());
 
 char *feedbackdir = NULL;
 
+// Set when running as a resident validator, see run_validator().
+bool resident_mode = false;
+
+// Thrown instead of exiting in resident mode, with the exit code.
+struct validator_result {
+    int exitcode;
+};
+
+// Exit with the given exit code, or in resident mode, end the check
+// of the current testcase with it.
+void validator_exit(int exitcode) {
+    if (resident_mode) throw validator_result{exitcode};
+    exit(exitcode);
+}
+
 void vreport_feedback(const std::string &category,
                       const std::string &msg,
                       va_list pvar) {
@@ -105,26 +181,220 @@ void wrong_answer(const std::string &msg, ...) {
     va_list pvar;
     va_start(pvar, msg);
     vreport_feedback(FILENAME_JUDGE_MESSAGE, msg, pvar);
-    exit(EXITCODE_WA);
+    validator_exit(EXITCODE_WA);
 }
 
 void judge_error(const std::string &msg, ...) {
     va_list pvar;
     va_start(pvar, msg);
     vreport_feedback(FILENAME_JUDGE_ERROR, msg, pvar);
+    if (resident_mode) validator_exit(EXIT_FAILURE);
     assert(0);
 }
 
 void accept() {
-    exit(EXITCODE_AC);
+    validator_exit(EXITCODE_AC);
 }
 
 void accept_with_score(double scorevalue) {
     report_feedback(FILENAME_SCORE, "%.9le", scorevalue);
-    exit(EXITCODE_AC);
+    validator_exit(EXITCODE_AC);
 }
 
 
+class input_reader {
+public:
+    // 'description' names the input in messages; 'on_error' is called
+    // with a message when the input does not match.
+    input_reader(const char *description, feedback_function on_error)
+        : description(description), on_error(on_error) {}
+
+    input_reader(const input_reader &) = delete;
+    input_reader &operator=(const input_reader &) = delete;
+
+    ~input_reader() {
+        reset();
+    }
+
+    // Read the file at 'path'. Returns false if it cannot be opened.
+    bool open(const char *path) {
+        reset();
+        int newfd = ::open(path, O_RDONLY | O_CLOEXEC);
+        if (newfd < 0) return false;
+        open(newfd);
+        own_fd = true;
+        return true;
+    }
+
+    // Read from file descriptor 'fd', which is not closed afterwards.
+    // Regular files are mapped into memory, anything else is read in
+    // blocks as data is needed.
+    void open(int newfd) {
+        reset();
+        fd = newfd;
+        struct stat st;
+        if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+            void *map = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (map != MAP_FAILED) {
+                madvise(map, st.st_size, MADV_SEQUENTIAL);
+                data = static_cast<const char *>(map);
+                end = st.st_size;
+                mapped = true;
+                eof = true;
+                return;
+            }
+        }
+        buffer.resize(BLOCK_SIZE);
+        data = buffer.data();
+    }
+
+    std::string_view read_token() {
+        skip_whitespace();
+        if (pos == end) fail("unexpected end of file");
+
+        size_t start = pos;
+        while (true) {
+            while (pos < end && !is_space(data[pos])) pos++;
+            if (pos < end) break;
+            // The token may continue in the next block.
+            size_t len = pos - start;
+            bool more = fill(start);
+            start = pos - len;
+            if (!more) break;
+        }
+        return std::string_view(data + start, pos - start);
+    }
+
+    long long read_int() {
+        std::string_view token = read_token();
+        const char *first = token.data(), *last = token.data() + token.size();
+        if (*first == '+' && token.size() > 1 && first[1] != '-') first++;
+        long long value;
+        auto [ptr, ec] = std::from_chars(first, last, value);
+        if (ec == std::errc::result_out_of_range) fail("integer out of range", token);
+        if (ec != std::errc() || ptr != last) fail("expected an integer", token);
+        return value;
+    }
+
+    long long read_int(long long min, long long max) {
+        long long value = read_int();
+        if (value < min || value > max) {
+            std::string range = "integer not in range [" + std::to_string(min) + ", " +
+                                std::to_string(max) + "]";
+            fail(range.c_str(), std::to_string(value));
+        }
+        return value;
+    }
+
+    double read_double() {
+        std::string_view token = read_token();
+        // strtod needs a terminated string, numbers are short.
+        char small[64];
+        std::string large;
+        const char *str = small;
+        if (token.size() < sizeof(small)) {
+            memcpy(small, token.data(), token.size());
+            small[token.size()] = 0;
+        } else {
+            large = token;
+            str = large.c_str();
+        }
+        char *ptr;
+        double value = strtod(str, &ptr);
+        if (ptr != str + token.size()) fail("expected a floating point number", token);
+        if (!std::isfinite(value)) fail("expected a finite floating point number", token);
+        return value;
+    }
+
+    // Whether all input has been read, apart from whitespace.
+    bool at_eof() {
+        skip_whitespace();
+        return pos == end;
+    }
+
+    // Line number (starting at 1) of the last token read.
+    long line() const { return line_number; }
+
+private:
+    static const size_t BLOCK_SIZE = 1 << 20;
+
+    const char *description;
+    feedback_function on_error;
+    int fd = -1;
+    bool own_fd = false;
+    bool mapped = false;
+    bool eof = false;
+    std::vector<char> buffer;
+    const char *data = nullptr;
+    size_t pos = 0, end = 0;
+    long line_number = 1;
+
+    // Stop reading from the current input, to read another one.
+    void reset() {
+        if (mapped) munmap(const_cast<char *>(data), end);
+        if (own_fd) close(fd);
+        fd = -1;
+        own_fd = mapped = eof = false;
+        data = nullptr;
+        pos = end = 0;
+        line_number = 1;
+    }
+
+    static bool is_space(char c) {
+        return c == ' ' || c == '\n' || c == '\t' || c == '\r' || c == '\v' || c == '\f';
+    }
+
+    void skip_whitespace() {
+        while (true) {
+            while (pos < end && is_space(data[pos])) {
+                if (data[pos] == '\n') line_number++;
+                pos++;
+            }
+            if (pos < end || !fill(pos)) return;
+        }
+    }
+
+    // Read more data into the buffer, discarding the data before 'keep'.
+    // Returns false at end of file.
+    bool fill(size_t keep) {
+        if (eof) return false;
+        memmove(buffer.data(), buffer.data() + keep, end - keep);
+        end -= keep;
+        pos -= keep;
+        if (end == buffer.size()) buffer.resize(2 * buffer.size());
+        data = buffer.data();
+
+        ssize_t nread;
+        do {
+            nread = ::read(fd, buffer.data() + end, buffer.size() - end);
+        } while (nread < 0 && errno == EINTR);
+        if (nread < 0) fail(strerror(errno));
+        if (nread == 0) {
+            eof = true;
+            return false;
+        }
+        end += nread;
+        return true;
+    }
+
+    // Report that the input does not match, showing 'token' if given.
+    [[noreturn]] void fail(const char *what, std::string_view token = {}) {
+        const size_t max_shown = 50;
+        if (token.empty()) {
+            on_error("%s line %ld: %s\n", description, line_number, what);
+        } else {
+            on_error("%s line %ld: %s, got '%.*s%s'\n", description, line_number, what,
+                     (int)std::min(token.size(), max_shown), token.data(),
+                     token.size() > max_shown ? "..." : "");
+        }
+        abort();
+    }
+};
+
+input_reader judge_in_reader("judge input", judge_error);
+input_reader judge_ans_reader("judge answer", judge_error);
+input_reader author_out_reader("team output", wrong_answer);
+
 bool is_directory(const char *path) {
     struct stat entry;
     return stat(path, &entry) == 0 && S_ISDIR(entry.st_mode);
@@ -143,6 +413,10 @@ void init_io(int argc, char **argv) {
     }
     feedbackdir = argv[3];
 
+    // In resident mode, these may still be open from the previous testcase.
+    judge_in.close();
+    judge_ans.close();
+
     judge_in.open(argv[1], std::ios_base::in);
     if (judge_in.fail()) {
         judge_error("%s: failed to open %s\n", argv[0], argv[1]);
@@ -154,4 +428,168 @@ void init_io(int argc, char **argv) {
     }
 
     author_out.rdbuf(std::cin.rdbuf());
+    author_out.clear();
+
+    if (!judge_in_reader.open(argv[1])) {
+        judge_error("%s: failed to open %s\n", argv[0], argv[1]);
+    }
+    if (!judge_ans_reader.open(argv[2])) {
+        judge_error("%s: failed to open %s\n", argv[0], argv[2]);
+    }
+    author_out_reader.open(STDIN_FILENO);
+}
+
+bool read_full(int fd, char *buf, size_t len) {
+    while (len > 0) {
+        ssize_t n = read(fd, buf, len);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        buf += n;
+        len -= n;
+    }
+    return true;
+}
+
+bool write_full(int fd, const char *buf, size_t len) {
+    while (len > 0) {
+        ssize_t n = write(fd, buf, len);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0) return false;
+        buf += n;
+        len -= n;
+    }
+    return true;
+}
+
+// Read a request of a resident validator into 'args'. Returns false at
+// end of file.
+bool read_request(int fd, std::vector<std::string> &args) {
+    std::string header;
+    char c;
+    while (true) {
+        if (!read_full(fd, &c, 1)) return false;
+        if (c == '\n') break;
+        header += c;
+    }
+    std::string payload(strtoul(header.c_str(), NULL, 10), '\0');
+    if (!read_full(fd, &payload[0], payload.size())) return false;
+
+    args.clear();
+    std::istringstream fields(payload);
+    std::string field;
+    while (std::getline(fields, field, '\0')) args.push_back(field);
+    return true;
+}
+
+// CPU time in seconds used by this process so far.
+double cpu_time() {
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0) return 0;
+    return usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6 +
+           usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6;
+}
+
+// Peak memory in bytes of this process since it was last reset.
+long long peak_memory() {
+    std::ifstream status("/proc/self/status");
+    std::string line;
+    while (std::getline(status, line)) {
+        if (line.rfind("VmHWM:", 0) == 0) return atoll(line.c_str() + 6) * 1024;
+    }
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0) return 0;
+    return usage.ru_maxrss * 1024LL;
+}
+
+// Make file descriptor 'target' refer to the file at 'path'.
+void redirect_fd(int target, const std::string &path, int flags) {
+    int fd = open(path.c_str(), flags | O_CLOEXEC);
+    if (fd < 0) {
+        judge_error("failed to open %s: %s\n", path.c_str(), strerror(errno));
+    }
+    if (dup2(fd, target) < 0) {
+        judge_error("failed to redirect to %s: %s\n", path.c_str(), strerror(errno));
+    }
+    close(fd);
+}
+
+int run_resident(char *progname, void (*check)(int, char **)) {
+    // Requests come in on stdin and results go out on stdout. Move these
+    // out of the way, to set up stdin, stdout and stderr per testcase.
+    int requests = fcntl(STDIN_FILENO, F_DUPFD_CLOEXEC, 3);
+    int results = fcntl(STDOUT_FILENO, F_DUPFD_CLOEXEC, 3);
+    int log = fcntl(STDERR_FILENO, F_DUPFD_CLOEXEC, 3);
+    int devnull = open("/dev/null", O_RDONLY | O_CLOEXEC);
+    if (requests < 0 || results < 0 || log < 0 || devnull < 0 ||
+        dup2(devnull, STDIN_FILENO) < 0 || dup2(log, STDOUT_FILENO) < 0) {
+        perror("setting up resident mode");
+        return EXIT_FAILURE;
+    }
+    // Writing "5" resets the peak memory. Open it before we are no longer
+    // dumpable, after which it is owned by root.
+    int clear_refs = open("/proc/self/clear_refs", O_WRONLY | O_CLOEXEC);
+    // We may run as the same user as the submissions, which must not be
+    // able to attach to us and change the results.
+    prctl(PR_SET_DUMPABLE, 0);
+    resident_mode = true;
+
+    const char handshake[] = "DOMJUDGE-RESIDENT 1\n";
+    if (!write_full(results, handshake, strlen(handshake))) return EXIT_FAILURE;
+
+    std::vector<std::string> args;
+    while (read_request(requests, args)) {
+        int exitcode = EXITCODE_AC;
+        if (clear_refs >= 0 && write(clear_refs, "5", 1) != 1) {
+            close(clear_refs);
+            clear_refs = -1;
+        }
+        double start_time = cpu_time();
+        try {
+            if (args.size() < 6) {
+                fprintf(stderr, "%s: invalid request with %zu arguments\n", progname, args.size());
+                throw validator_result{EXIT_FAILURE};
+            }
+            redirect_fd(STDOUT_FILENO, args[0], O_WRONLY | O_TRUNC);
+            redirect_fd(STDERR_FILENO, args[1], O_WRONLY | O_TRUNC);
+            redirect_fd(STDIN_FILENO, args[5], O_RDONLY);
+            // Drop what was buffered from the previous submission output.
+            clearerr(stdin);
+            __fpurge(stdin);
+            std::cin.clear();
+
+            std::vector<char *> argv = { progname, &args[2][0], &args[3][0], &args[4][0] };
+            for (size_t i = 6; i < args.size(); i++) argv.push_back(&args[i][0]);
+            int argc = argv.size();
+            argv.push_back(NULL);
+
+            init_io(argc, argv.data());
+            check(argc, argv.data());
+        } catch (const validator_result &result) {
+            exitcode = result.exitcode;
+        }
+
+        std::cout.flush();
+        std::cerr.flush();
+        fflush(stdout);
+        fflush(stderr);
+        dup2(devnull, STDIN_FILENO);
+        dup2(log, STDOUT_FILENO);
+        dup2(log, STDERR_FILENO);
+
+        char result[64];
+        int len = snprintf(result, sizeof(result), "%d %.3f %lld\n", exitcode,
+                           cpu_time() - start_time, peak_memory());
+        if (!write_full(results, result, len)) return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
+
+int run_validator(int argc, char **argv, void (*check)(int, char **)) {
+    if (argc == 2 && strcmp(argv[1], "--resident") == 0) {
+        return run_resident(argv[0], check);
+    }
+    init_io(argc, argv);
+    check(argc, argv);
+    accept();
+    return EXITCODE_AC;
 }
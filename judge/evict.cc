@@ -1,14 +1,26 @@
 #include "config.h"
 
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <fstream>
 #include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
 #include <string>
+#include <system_error>
+#include <thread>
 #include <vector>
 
 #include <dirent.h>
 #include <fcntl.h>
 #include <getopt.h>
 #include <unistd.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
+#include <sys/syscall.h>
 #include <cstring>
 #include <cstdlib>
 
@@ -19,19 +31,40 @@
 #define PROGRAM "evict"
 #define VERSION DOMJUDGE_VERSION "/" REVISION
 
+/* Default number of threads to walk the directory tree with. Evicting is
+ * mostly waiting for the kernel, so a few threads help even on a single
+ * CPU, while many only contend on the directory locks. */
+#define DEFAULT_JOBS 4
+#define MAX_JOBS 64
+
 std::string_view progname;
 
 bool be_verbose;
+bool show_stats;
 int show_help;
 int show_version;
 bool one_file_system;
+bool show_residency;
+int njobs;
+
+/* Eviction policy: by default all regular files are evicted. */
+bool exclude_content_addressed;
+bool have_newer;
+struct timespec newer_than;
+std::set<std::pair<dev_t, ino_t>> keep_files;
 
 struct option const long_opts[] = {
-	{"verbose",         no_argument, nullptr,       'v'},
-	{"one-file-system", no_argument, nullptr,       'x'},
-	{"help",            no_argument, &show_help,     1 },
-	{"version",         no_argument, &show_version,  1 },
-	{ nullptr,          0,           nullptr,        0 }
+	{"verbose",         no_argument,       nullptr,       'v'},
+	{"one-file-system", no_argument,       nullptr,       'x'},
+	{"jobs",            required_argument, nullptr,       'j'},
+	{"stats",           no_argument,       nullptr,       's'},
+	{"newer",           required_argument, nullptr,       'n'},
+	{"exclude-content-addressed", no_argument, nullptr,   'c'},
+	{"keep",            required_argument, nullptr,       'k'},
+	{"residency",       no_argument,       nullptr,       'r'},
+	{"help",            no_argument,       &show_help,     1 },
+	{"version",         no_argument,       &show_version,  1 },
+	{ nullptr,          0,                 nullptr,        0 }
 };
 
 void usage()
@@ -40,75 +73,432 @@ void usage()
               << "Evicts all files in a directory tree from the kernel filesystem cache." << std::endl << std::endl
               << "  -v, --verbose          display some extra warnings and information" << std::endl
               << "  -x, --one-file-system  stay on this filesystem" << std::endl
+              << "  -j, --jobs=N           walk the tree with N threads (default: " << DEFAULT_JOBS << ")" << std::endl
+              << "  -s, --stats            report the number of files evicted and time taken" << std::endl
+              << "  -n, --newer=TIME       only evict files modified or created after TIME, given" << std::endl
+              << "                           in seconds since the epoch or as a reference file" << std::endl
+              << "  -c, --exclude-content-addressed" << std::endl
+              << "                         do not evict files named by their content hash, like" << std::endl
+              << "                           cached testcases '<hash>.in' and '<hash>.out'" << std::endl
+              << "  -k, --keep=MANIFEST    do not evict the files listed in MANIFEST, one path per" << std::endl
+              << "                           line, relative to DIRECTORY unless absolute" << std::endl
+              << "  -r, --residency        measure the page cache used by the files before and" << std::endl
+              << "                           after evicting, and report it per top-level directory" << std::endl
               << "      --help             display this help and exit" << std::endl
               << "      --version          output version information and exit" << std::endl << std::endl;
 	exit(0);
 }
 
-void evict_directory(const std::string& dirname, dev_t root_dev) {
-	DIR *dir;
-	struct dirent *entry;
-	int fd = -1;
+/* Whether the file name is a content hash of at least 32 hexadecimal digits
+ * followed by an extension, as the cached testcases '<hash>.in' and
+ * '<hash>.out' (and the answer index '<hash>.out.idx') are named. */
+bool is_content_addressed(const char *name)
+{
+	size_t n = strspn(name, "0123456789abcdef");
+	return n>=32 && name[n]=='.';
+}
+
+bool timespec_after(const struct timespec& a, const struct timespec& b)
+{
+	return a.tv_sec>b.tv_sec || (a.tv_sec==b.tv_sec && a.tv_nsec>b.tv_nsec);
+}
+
+/* Whether the file was modified or created (which sets its ctime) after 't'. */
+bool changed_after(const struct stat& s, const struct timespec& t)
+{
+	return timespec_after(s.st_mtim, t) || timespec_after(s.st_ctim, t);
+}
+
+/* Parse the argument of --newer: seconds since the epoch, possibly with a
+ * fraction, or otherwise a file whose modification time is used. */
+bool parse_newer(const char *arg, struct timespec& t)
+{
+	char *end;
+	errno = 0;
+	double secs = strtod(arg, &end);
+	if ( *arg!='\0' && *end=='\0' && errno==0 && secs>=0 ) {
+		t.tv_sec = (time_t)secs;
+		t.tv_nsec = (long)((secs - (double)t.tv_sec) * 1e9);
+		return true;
+	}
 	struct stat s;
+	if ( stat(arg, &s)<0 ) {
+		logerror(errno, "Unable to stat reference file: {}", arg);
+		return false;
+	}
+	t = s.st_mtim;
+	return true;
+}
+
+/* Read the files to keep from 'manifest'. They are identified by device and
+ * inode, so that their other hard links are kept as well and the paths need
+ * not be compared for every file in the tree. */
+bool read_keep_manifest(const char *manifest, const std::string& dirname)
+{
+	std::ifstream in(manifest);
+	if ( !in ) {
+		logerror(errno, "Unable to open keep manifest: {}", manifest);
+		return false;
+	}
+	std::string line;
+	while ( std::getline(in, line) ) {
+		if ( line.empty() || line[0]=='#' ) continue;
+		std::string path = line[0]=='/' ? line : dirname + "/" + line;
+		struct stat s;
+		if ( lstat(path.c_str(), &s)<0 ) {
+			if (be_verbose) warning(errno, "Unable to stat file to keep: {}", path);
+			continue;
+		}
+		keep_files.insert({s.st_dev, s.st_ino});
+	}
+	return true;
+}
 
-	dir = opendir(dirname.c_str());
-	if (dir != nullptr) {
-		if (be_verbose) logmsg(LOG_INFO, "Evicting all files in directory: {}", dirname);
+/* cachestat() is available since Linux 6.5, but not yet in all headers. Its
+ * syscall number is the same on all architectures. */
+#ifndef __NR_cachestat
+#define __NR_cachestat 451
+#endif
 
-		/* Read everything in the directory */
-		while ( (entry = readdir(dir)) != nullptr ) {
-			/* skip over current/parent directory entries */
-			if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {
-				continue;
+struct evict_cachestat_range {
+	uint64_t off;
+	uint64_t len;
+};
+
+struct evict_cachestat {
+	uint64_t nr_cache;
+	uint64_t nr_dirty;
+	uint64_t nr_writeback;
+	uint64_t nr_evicted;
+	uint64_t nr_recently_evicted;
+};
+
+std::atomic<bool> have_cachestat(true);
+
+/* The number of bytes of the file that are in the page cache, or -1 if that
+ * cannot be determined. Uses cachestat() if the kernel supports it, and
+ * otherwise mincore() on a read-only mapping of the file, which does not
+ * fault in any pages. */
+long long resident_bytes(int fd, off_t size)
+{
+	static const long page_size = sysconf(_SC_PAGESIZE);
+	if ( size==0 ) return 0;
+
+	if ( have_cachestat ) {
+		struct evict_cachestat_range range = { 0, 0 }; // len 0: up to the end
+		struct evict_cachestat cs;
+		if ( syscall(__NR_cachestat, fd, &range, &cs, 0)==0 ) {
+			return (long long)cs.nr_cache * page_size;
+		}
+		if ( errno!=ENOSYS ) return -1;
+		have_cachestat = false;
+	}
+
+	void *map = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+	if ( map==MAP_FAILED ) return -1;
+	std::vector<unsigned char> pages((size + page_size - 1) / page_size);
+	long long res = -1;
+	if ( mincore(map, size, pages.data())==0 ) {
+		res = 0;
+		for (unsigned char p : pages) res += p & 1;
+		res *= page_size;
+	}
+	munmap(map, size);
+	return res;
+}
+
+/* Page cache used by the evicted files, before and after evicting them. */
+struct residency {
+	long long files = 0;
+	long long before = 0;
+	long long after = 0;
+
+	residency& operator+=(const residency& o) {
+		files += o.files;
+		before += o.before;
+		after += o.after;
+		return *this;
+	}
+};
+
+/* An open directory. It is shared by the tasks for its subdirectories, which
+ * are opened relative to it, and closed when the last of them is done. The
+ * path is only used in messages, and 'top' is the top-level directory it is
+ * in (empty for the root), for the residency report. */
+struct directory {
+	int fd;
+	std::string path;
+	std::string top;
+
+	directory(int fd_, std::string path_, std::string top_):
+		fd(fd_), path(std::move(path_)), top(std::move(top_)) {}
+	directory(const directory&) = delete;
+	directory& operator=(const directory&) = delete;
+
+	~directory() {
+		if ( close(fd)!=0 ) warning(errno, "Unable to close directory: {}", path);
+	}
+};
+
+/* A subdirectory 'name' of 'parent' still to be walked. Subdirectories are
+ * only opened when walked, so that wide trees do not run out of file
+ * descriptors. */
+struct dir_task {
+	std::shared_ptr<directory> parent;
+	std::string name;
+};
+
+struct evict_stats {
+	long long files = 0;
+	long long directories = 0;
+	long long skipped = 0;
+	long long errors = 0;
+	std::map<std::string, residency> resident;  // per top-level directory
+
+	evict_stats& operator+=(const evict_stats& o) {
+		files += o.files;
+		directories += o.directories;
+		skipped += o.skipped;
+		errors += o.errors;
+		for (const auto& [top, r] : o.resident) resident[top] += r;
+		return *this;
+	}
+};
+
+/*
+ * Walks a directory tree with a small pool of threads. Each thread has its
+ * own queue of directories: it takes the most recently found one from its
+ * own queue, so that it walks depth first and keeps few directories open,
+ * and steals the oldest one from another queue when its own is empty.
+ */
+class evict_pool {
+public:
+	explicit evict_pool(int nthreads): queues(nthreads), stats(nthreads) {}
+
+	evict_stats run(std::shared_ptr<directory> root, dev_t root_dev_)
+	{
+		root_dev = root_dev_;
+		pending = 1;
+		stats[0].directories++;
+		// The root is walked by the first worker, the others steal from it.
+		std::vector<std::thread> threads;
+		for (size_t i = 1; i < queues.size(); i++) {
+			try {
+				threads.emplace_back([this, i]() { worker(i, nullptr); });
+			} catch (const std::system_error& e) {
+				if (be_verbose) logmsg(LOG_DEBUG, "Unable to start thread: {}", e.what());
+				break;
 			}
+		}
+		worker(0, std::move(root));
+		for (auto& t : threads) t.join();
 
-			/* Construct the full file path */
-			std::string entry_path = dirname + "/" + entry->d_name;
+		evict_stats total;
+		for (const auto& s : stats) total += s;
+		return total;
+	}
 
-			if (lstat(entry_path.c_str(), &s) < 0) {
-				if (be_verbose) logerror(errno, "Unable to stat file/directory: {}", entry_path);
-				continue;
+private:
+	struct task_queue {
+		std::mutex lock;
+		std::deque<dir_task> tasks;
+	};
+
+	std::vector<task_queue> queues;
+	std::vector<evict_stats> stats;
+	// Directories queued or being walked; the walk is done when it drops to 0.
+	std::atomic<long> pending;
+	dev_t root_dev = 0;
+
+	void push(size_t self, dir_task task)
+	{
+		{
+			std::lock_guard<std::mutex> guard(queues[self].lock);
+			queues[self].tasks.push_back(std::move(task));
+		}
+		pending++;
+		pending.notify_all();
+	}
+
+	bool pop(size_t self, dir_task& task)
+	{
+		for (size_t i = 0; i < queues.size(); i++) {
+			task_queue& q = queues[(self + i) % queues.size()];
+			std::lock_guard<std::mutex> guard(q.lock);
+			if ( q.tasks.empty() ) continue;
+			if ( i==0 ) {
+				task = std::move(q.tasks.back());
+				q.tasks.pop_back();
+			} else {
+				task = std::move(q.tasks.front());
+				q.tasks.pop_front();
 			}
+			return true;
+		}
+		return false;
+	}
 
-			if (one_file_system && s.st_dev != root_dev) {
-				if (be_verbose) logmsg(LOG_DEBUG, "Skipping {}: different filesystem", entry_path);
+	void worker(size_t self, std::shared_ptr<directory> root)
+	{
+		if ( root ) {
+			walk(self, std::move(root));
+			done();
+		}
+		while ( true ) {
+			long p = pending;
+			if ( p==0 ) break;
+			dir_task task;
+			if ( !pop(self, task) ) {
+				// Sleep until directories are queued or the walk is done.
+				pending.wait(p);
 				continue;
 			}
+			std::shared_ptr<directory> dir = open_directory(self, task);
+			task.parent.reset();
+			if ( dir ) walk(self, std::move(dir));
+			done();
+		}
+	}
+
+	void done()
+	{
+		pending--;
+		pending.notify_all();
+	}
+
+	std::shared_ptr<directory> open_directory(size_t self, const dir_task& task)
+	{
+		std::string path = task.parent->path + "/" + task.name;
+		int fd = openat(task.parent->fd, task.name.c_str(),
+		                O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+		if ( fd<0 ) {
+			warning(errno, "Unable to open directory: {}", path);
+			stats[self].errors++;
+			return nullptr;
+		}
+		auto dir = std::make_shared<directory>(fd, std::move(path),
+		                                       task.parent->top.empty() ? task.name : task.parent->top);
+		if ( one_file_system ) {
+			struct stat s;
+			if ( fstat(fd, &s)<0 ) {
+				if (be_verbose) logerror(errno, "Unable to stat directory: {}", dir->path);
+				stats[self].errors++;
+				return nullptr;
+			}
+			if ( s.st_dev!=root_dev ) {
+				if (be_verbose) logmsg(LOG_DEBUG, "Skipping {}: different filesystem", dir->path);
+				stats[self].skipped++;
+				return nullptr;
+			}
+		}
+		stats[self].directories++;
+		return dir;
+	}
+
+	void evict_file(size_t self, const directory& dir, const char *name)
+	{
+		if ( exclude_content_addressed && is_content_addressed(name) ) {
+			if (be_verbose) logmsg(LOG_DEBUG, "Skipping {}/{}: content addressed", dir.path, name);
+			stats[self].skipped++;
+			return;
+		}
+
+		int fd = openat(dir.fd, name, O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+		if ( fd==-1 ) {
+			warning(errno, "Unable to open file: {}/{}", dir.path, name);
+			stats[self].errors++;
+			return;
+		}
+
+		/* Only stat the file if the policy needs it. */
+		struct stat s;
+		if ( (one_file_system || have_newer || !keep_files.empty() || show_residency) && fstat(fd, &s)<0 ) {
+			warning(errno, "Unable to stat file: {}/{}", dir.path, name);
+			stats[self].errors++;
+		} else if ( one_file_system && s.st_dev!=root_dev ) {
+			if (be_verbose) logmsg(LOG_DEBUG, "Skipping {}/{}: different filesystem", dir.path, name);
+			stats[self].skipped++;
+		} else if ( keep_files.count({s.st_dev, s.st_ino}) ) {
+			if (be_verbose) logmsg(LOG_DEBUG, "Skipping {}/{}: listed in keep manifest", dir.path, name);
+			stats[self].skipped++;
+		} else if ( have_newer && !changed_after(s, newer_than) ) {
+			if (be_verbose) logmsg(LOG_DEBUG, "Skipping {}/{}: not changed recently", dir.path, name);
+			stats[self].skipped++;
+		} else {
+			long long before = show_residency ? resident_bytes(fd, s.st_size) : 0;
+			if ( int err = posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED) ) {
+				warning(err, "Unable to evict file: {}/{}", dir.path, name);
+				stats[self].errors++;
+			} else {
+				if (be_verbose) logmsg(LOG_DEBUG, "Evicted file: {}/{}", dir.path, name);
+				stats[self].files++;
+				long long after = show_residency ? resident_bytes(fd, s.st_size) : 0;
+				if ( show_residency && before>=0 && after>=0 ) {
+					residency& r = stats[self].resident[dir.top.empty() ? "." : dir.top];
+					r.files++;
+					r.before += before;
+					r.after += after;
+				}
+			}
+		}
+
+		if ( close(fd)!=0 ) {
+			warning(errno, "Unable to close file: {}/{}", dir.path, name);
+		}
+	}
 
-			if (S_ISDIR(s.st_mode)) {
-				/* Recurse into subdirectories */
-				evict_directory(entry_path, root_dev);
-			} else if (S_ISREG(s.st_mode)) {
-				/* evict this file from the cache */
-				fd = open(entry_path.c_str(), O_RDONLY, 0);
-				if (fd == -1) {
-					warning(errno, "Unable to open file: {}", entry_path);
+	/* Evict the files in 'dir' and queue its subdirectories. The entries
+	 * are read with getdents64() and their type taken from d_type, so that
+	 * they need not be stat'ed unless the filesystem does not provide it. */
+	void walk(size_t self, std::shared_ptr<directory> dirp)
+	{
+		directory& dir = *dirp;
+		if (be_verbose) logmsg(LOG_INFO, "Evicting all files in directory: {}", dir.path);
+
+		alignas(struct dirent64) char buf[1 << 16];
+		ssize_t n;
+		while ( (n = getdents64(dir.fd, buf, sizeof(buf)))>0 ) {
+			for (ssize_t off = 0; off < n; ) {
+				auto *entry = reinterpret_cast<struct dirent64 *>(buf + off);
+				off += entry->d_reclen;
+				const char *name = entry->d_name;
+				/* skip over current/parent directory entries */
+				if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0) {
 					continue;
 				}
 
-				if (posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED)) {
-					warning(errno, "Unable to evict file: {}", entry_path);
-				} else {
-					if (be_verbose) logmsg(LOG_DEBUG, "Evicted file: {}", entry_path);
+				unsigned char type = entry->d_type;
+				if ( type==DT_UNKNOWN ) {
+					struct stat s;
+					if ( fstatat(dir.fd, name, &s, AT_SYMLINK_NOFOLLOW)<0 ) {
+						if (be_verbose) logerror(errno, "Unable to stat file/directory: {}/{}", dir.path, name);
+						stats[self].errors++;
+						continue;
+					}
+					type = S_ISDIR(s.st_mode) ? DT_DIR : S_ISREG(s.st_mode) ? DT_REG : DT_UNKNOWN;
 				}
 
-				if ( close(fd)!=0 ) {
-					warning(errno, "Unable to close file: {}", entry_path);
+				if ( type==DT_DIR ) {
+					/* Queue subdirectories, keeping this one open for them. */
+					push(self, dir_task{dirp, name});
+				} else if ( type==DT_REG ) {
+					/* evict this file from the cache */
+					evict_file(self, dir, name);
+				} else {
+					/* We should never encounter other file types like symlinks,
+					 * devices, or sockets in the judging directory, and they
+					 * don't need to be evicted from the cache anyway. */
+					if (be_verbose) logmsg(LOG_DEBUG, "Skipping {}/{}: not a directory or regular file", dir.path, name);
+					stats[self].skipped++;
 				}
-			} else {
-				/* We should never encounter other file types like symlinks,
-				 * devices, or sockets in the judging directory, and they
-				 * don't need to be evicted from the cache anyway. */
-				if (be_verbose) logmsg(LOG_DEBUG, "Skipping {}: not a directory or regular file", entry_path);
 			}
 		}
-		if ( closedir(dir)!=0 ) {
-			warning(errno, "Unable to close directory: {}", dirname);
+		if ( n<0 ) {
+			warning(errno, "Unable to read directory: {}", dir.path);
+			stats[self].errors++;
 		}
-	} else {
-		warning(errno, "Unable to open directory: {}", dirname);
 	}
-}
+};
 
 int main(int argc, char *argv[])
 {
@@ -117,10 +507,13 @@ int main(int argc, char *argv[])
 	progname = argv[0];
 
 	/* Parse command-line options */
-	be_verbose = one_file_system = false;
+	const char *keep_manifest = nullptr;
+	be_verbose = one_file_system = show_stats = show_residency = false;
+	exclude_content_addressed = have_newer = false;
 	show_help = show_version = 0;
+	njobs = DEFAULT_JOBS;
 	opterr = 0;
-	while ( (opt = getopt_long(argc,argv,"+vx",long_opts,nullptr))!=-1 ) {
+	while ( (opt = getopt_long(argc,argv,"+vxj:sn:ck:r",long_opts,nullptr))!=-1 ) {
 		switch ( opt ) {
 		case 0:   /* long-only option */
 			break;
@@ -131,6 +524,29 @@ int main(int argc, char *argv[])
 		case 'x': /* one-file-system option */
 			one_file_system = true;
 			break;
+		case 'j': /* jobs option */
+			njobs = atoi(optarg);
+			if ( njobs<1 || njobs>MAX_JOBS ) {
+				logmsg(LOG_ERR, "invalid number of jobs `{}`", optarg);
+				return 1;
+			}
+			break;
+		case 's': /* stats option */
+			show_stats = true;
+			break;
+		case 'n': /* newer option */
+			if ( !parse_newer(optarg, newer_than) ) return 1;
+			have_newer = true;
+			break;
+		case 'c': /* exclude-content-addressed option */
+			exclude_content_addressed = true;
+			break;
+		case 'k': /* keep option */
+			keep_manifest = optarg;
+			break;
+		case 'r': /* residency option */
+			show_residency = true;
+			break;
 		case ':': /* getopt error */
 		case '?':
 			logmsg(LOG_ERR, "unknown option or missing argument `{}`", (char)optopt);
@@ -151,17 +567,49 @@ int main(int argc, char *argv[])
 	/* directory to evict */
 	std::string dirname = argv[optind];
 
+	auto start = std::chrono::steady_clock::now();
+
+	if ( keep_manifest!=nullptr && !read_keep_manifest(keep_manifest, dirname) ) return 1;
+
+	int fd = open(dirname.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if ( fd<0 ) {
+		warning(errno, "Unable to open directory: {}", dirname);
+		return 0;
+	}
+	auto root = std::make_shared<directory>(fd, dirname, "");
+
 	dev_t root_dev = 0;
 	if (one_file_system) {
 		struct stat s;
-		if (stat(dirname.c_str(), &s) < 0) {
+		if (fstat(fd, &s) < 0) {
 			logerror(errno, "Unable to stat directory: {}", dirname);
 			return 1;
 		}
 		root_dev = s.st_dev;
 	}
 
-	evict_directory(dirname, root_dev);
+	evict_stats stats = evict_pool(njobs).run(std::move(root), root_dev);
+
+	if ( show_stats ) {
+		std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+		std::cout << std::format("Evicted {} files in {} directories in {:.3f}s using {} threads, "
+		                         "skipped {}, {} errors",
+		                         stats.files, stats.directories, elapsed.count(), njobs,
+		                         stats.skipped, stats.errors) << std::endl;
+	}
+
+	if ( show_residency ) {
+		residency total;
+		std::cout << std::format("{:<32} {:>8} {:>14} {:>14} {:>14}", "directory", "files",
+		                         "cached before", "cached after", "evicted") << std::endl;
+		for (const auto& [top, r] : stats.resident) {
+			std::cout << std::format("{:<32} {:>8} {:>14} {:>14} {:>14}", top, r.files,
+			                         r.before, r.after, r.before - r.after) << std::endl;
+			total += r;
+		}
+		std::cout << std::format("{:<32} {:>8} {:>14} {:>14} {:>14}", "total", total.files,
+		                         total.before, total.after, total.before - total.after) << std::endl;
+	}
 
 	return 0;
 }
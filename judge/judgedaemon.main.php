@@ -40,7 +40,8 @@ enum Verdict
  *     exitcode: string, memory-bytes: string, time-used: string, time-result: string,
  *     stdin-bytes: string, stdout-bytes: string, stderr-bytes: string,
  *     cpu-time: string, sys-time: string, user-time: string, wall-time: string,
- *     entry_point?: string, output-truncated?: string, signal?: string
+ *     entry_point?: string, output-truncated?: string, signal?: string,
+ *     cache-reclaimed-bytes?: string, zygote-startup-saved?: string, zygote-failed?: string
  * }
  */
 readonly class ProgramMetadata
@@ -106,7 +107,8 @@ readonly class ProgramMetadata
  *     exitcode: string, memory-bytes: string, time-used: string, bytes-transferred: string,
  *     stdin-bytes: string, stdout-bytes: string, stderr-bytes: string, cpu-time: string,
  *     sys-time: string, user-time: string, wall-time: string, total-duration-use: string,
- *     output-truncated?: string, time-result?: string, validator-exited-first?: string
+ *     output-truncated?: string, time-result?: string, validator-exited-first?: string,
+ *     passes?: string
  * }
  */
 readonly class CompareMetadata
@@ -143,6 +145,7 @@ readonly class VerdictInput
         public bool            $combinedRunCompare,
         public int             $programOutSize,
         public bool            $compareTimedOut = false,
+        public bool            $stoppedEarly = false,
     ) {
     }
 }
@@ -217,14 +220,44 @@ class JudgeDaemon
 
     /** @var ?resource */
     private $lockfile;
+
+    /**
+     * Running resident output validators, see RESIDENT_VALIDATOR, keyed by
+     * their command and ordered from least to most recently used.
+     * @var array<string, array{process: resource, requests: resource, results: resource}>
+     */
+    private array $residentValidators = [];
+    /** @var array<string, true> Commands of validators that do not support resident mode. */
+    private array $nonResidentValidators = [];
+    /** @var array<string, true> Validators that could not build an answer index, see ANSWER_INDEX. */
+    private array $nonIndexingValidators = [];
+
+    /**
+     * Running zygote of the current judging, see ZYGOTE.
+     * @var ?array{workdir: string, process: resource, socket: string}
+     */
+    private ?array $zygote = null;
     /** @var array<int, string> */
     private array $EXITCODES;
     private string $runuser;
     private string $rungroup;
+    /**
+     * User to run output validators as that run concurrently with the
+     * submissions, see STREAM_COMPARE and RESIDENT_VALIDATOR.
+     */
+    private ?string $streamuser = null;
 
     const INITIAL_WAITTIME_SEC = 0.1;
     const MAXIMAL_WAITTIME_SEC = 5.0;
 
+    const MAX_RESIDENT_VALIDATORS = 4;
+    const RESIDENT_HANDSHAKE = "DOMJUDGE-RESIDENT 1\n";
+    const RESIDENT_STARTUP_TIMEOUT_SEC = 10.0;
+    const ZYGOTE_STARTUP_TIMEOUT_SEC = 10.0;
+    // Start of an answer index written by the default output validator,
+    // see INDEX_MAGIC in compare.cc.
+    const ANSWER_INDEX_MAGIC = 'DJCMPIDX';
+
     const SCRIPT_ID = 'judgedaemon';
     const CHROOT_SCRIPT = 'chroot-startstop.sh';
 
@@ -354,6 +387,17 @@ class JudgeDaemon
             if (!posix_getpwnam($this->runuser)) {
                 error("runuser $this->runuser does not exist.");
             }
+            if (STREAM_COMPARE || RESIDENT_VALIDATOR) {
+                if (posix_getpwnam($this->runuser . '-validator')) {
+                    $this->streamuser = $this->runuser . '-validator';
+                } elseif (STREAM_COMPARE) {
+                    logmsg(LOG_WARNING, "STREAM_COMPARE requires user $this->runuser-validator, disabling it.");
+                }
+                if (RESIDENT_VALIDATOR && $this->streamuser === null) {
+                    logmsg(LOG_WARNING, "User $this->runuser-validator does not exist, " .
+                        "running resident validators as $this->runuser.");
+                }
+            }
 
             define('LOCKFILE', RUNDIR . '/judge.' . $this->myhost . '.lock');
             if (($this->lockfile = fopen(LOCKFILE, 'c')) === false) {
@@ -482,6 +526,8 @@ class JudgeDaemon
             }
             if ($this->exitsignalled) {
                 logmsg(LOG_NOTICE, "Received signal, exiting.");
+                $this->stopResidentValidators();
+                $this->stopZygote();
                 $this->closeCurlHandles();
                 fclose($this->lockfile);
                 exit;
@@ -644,6 +690,8 @@ class JudgeDaemon
         // Check if we were interrupted while judging, if so, exit (to avoid sleeping)
         if ($this->exitsignalled) {
             logmsg(LOG_NOTICE, "Received signal, exiting.");
+            $this->stopResidentValidators();
+            $this->stopZygote();
             $this->closeCurlHandles();
             fclose($this->lockfile);
             exit;
@@ -1493,6 +1541,9 @@ class JudgeDaemon
 
     private function cleanupJudging(string $workdir): void
     {
+        // The zygote has the chroot open, so stop it first.
+        $this->stopZygote();
+
         // revoke readablity for domjudge-run user to this workdir
         chmod($workdir, 0700);
 
@@ -1507,7 +1558,12 @@ class JudgeDaemon
             // starting.
         }
 
-        // Evict all contents of the workdir from the kernel fs cache
+        // Evict all contents of the workdir from the kernel fs cache. The
+        // cached testcases, which the next judging likely reads again, are
+        // not in there: it only has copies of them. This is also needed
+        // with CGROUP_RECLAIM, as the files that we wrote ourselves, such as
+        // those copies, the compile output and the executables, are not
+        // charged to the cgroups of the runs.
         if (!$this->runCommandSafe([LIBJUDGEDIR . '/evict', '-x', $workdir])) {
             warning("evict script failed, continuing gracefully");
         }
@@ -1795,6 +1851,13 @@ class JudgeDaemon
             return Verdict::WRONG_ANSWER;
         }
 
+        // With a streaming compare, the submission was stopped because the
+        // validator already rejected its output, so its exit status and
+        // runtime are meaningless.
+        if ($input->stoppedEarly && $input->compareExitcode === self::COMPARE_EXITCODE_WRONG_ANSWER) {
+            return Verdict::WRONG_ANSWER;
+        }
+
         // Check for timelimit
         if ($input->programMeta->hasTimelimitExceeded()) {
             return Verdict::TIMELIMIT;
@@ -1830,11 +1893,12 @@ class JudgeDaemon
         ProgramMetadata $programMeta,
         CompareMetadata $compareMeta,
         bool $combinedRunCompare,
-        int $filelimit
+        int $filelimit,
+        bool $stoppedEarly = false
     ): ?string {
         return match ($verdict) {
             Verdict::CORRECT => "Correct!",
-            Verdict::WRONG_ANSWER => $this->getWrongAnswerMessage($programMeta, $compareMeta, $combinedRunCompare),
+            Verdict::WRONG_ANSWER => $this->getWrongAnswerMessage($programMeta, $compareMeta, $combinedRunCompare, $stoppedEarly),
             Verdict::TIMELIMIT => "Timelimit exceeded.",
             Verdict::RUN_ERROR => "Non-zero exitcode " . $programMeta->exitcode,
             Verdict::OUTPUT_LIMIT => "Output limit exceeded: " . $programMeta->stdoutBytes
@@ -1847,10 +1911,16 @@ class JudgeDaemon
     /**
      * Get appropriate message for wrong answer verdict, including any override info.
      */
-    private function getWrongAnswerMessage(ProgramMetadata $programMeta, CompareMetadata $compareMeta, bool $combinedRunCompare): string
-    {
+    private function getWrongAnswerMessage(
+        ProgramMetadata $programMeta,
+        CompareMetadata $compareMeta,
+        bool $combinedRunCompare,
+        bool $stoppedEarly = false
+    ): string {
         $prefix = '';
-        if ($combinedRunCompare && $compareMeta->validatorExitedFirst) {
+        if ($stoppedEarly) {
+            $prefix = "Submission stopped early, validator already rejected its output.";
+        } elseif ($combinedRunCompare && $compareMeta->validatorExitedFirst) {
             if ($programMeta->hasTimelimitExceeded()) {
                 $prefix = "Timelimit exceeded, but validator exited first with WA.";
             } elseif ($programMeta->hasRunError()) {
@@ -1860,6 +1930,549 @@ class JudgeDaemon
         return $prefix . (empty($prefix) ? "" : " ") . "Wrong answer!";
     }
 
+    /**
+     * Create the feedback directory for the output validator and make it writable for it.
+     */
+    private function prepareFeedbackDir(string $dir): bool
+    {
+        if (!is_dir($dir)) {
+            if (!mkdir($dir, 0777, true)) {
+                logmsg(LOG_WARNING, "Could not create '$dir'.");
+                return false;
+            }
+        }
+        // We need to set permissions explicitly for two reasons:
+        // `umask` might block them from being 0777, and for multi-pass problems there is the implicit contract
+        // of keeping files around between passes. This is ugly, but what the spec currently dictates.
+        // Cannot use `chmod` here directly because of recursion.
+        if (!$this->runCommandSafe(
+            [
+                'chmod',
+                '-R',
+                'go+w',
+                $dir,
+            ]
+        )) {
+            logmsg(LOG_WARNING, "Could not chmod '$dir' to go+w.");
+            return false;
+        }
+        return true;
+    }
+
+    /**
+     * Let the output validator index the test answer once, see ANSWER_INDEX.
+     * Failure is not an error: the validator then simply parses the answer.
+     * Only the default output validator supports this; the index it writes
+     * starts with ANSWER_INDEX_MAGIC. A validator that fails to write one is
+     * not asked again, so that custom validators are not started for nothing
+     * and cannot leave a bogus index.
+     *
+     * @param CompareConfig $compare_config
+     */
+    private function buildAnswerIndex(string $compare_runpath, string $output, array $compare_config): void
+    {
+        $index = "$output.idx";
+        if (file_exists($index) || isset($this->nonIndexingValidators[$compare_runpath])) {
+            return;
+        }
+        logmsg(LOG_DEBUG, "Building index of test answer '$output'");
+        $tmpindex = "$index.tmp-" . getmypid();
+        $ok = $this->runCommandSafe(
+            [
+                'sudo', '-n', BINDIR . "/runguard",
+                "--user=$this->runuser",
+                "--group=$this->rungroup",
+                "-m", (string)$compare_config['script_memory_limit'],
+                "-t", (string)$compare_config['script_timelimit'],
+                "--no-core",
+                "--",
+                $compare_runpath, '--build-index', $output,
+            ],
+            log_nonzero_exitcode: false,
+            stdout_target: $tmpindex
+        );
+        if (!$ok || file_get_contents($tmpindex, length: strlen(self::ANSWER_INDEX_MAGIC)) !== self::ANSWER_INDEX_MAGIC) {
+            logmsg(LOG_INFO, "Output validator '$compare_runpath' does not support building an answer index.");
+            $this->nonIndexingValidators[$compare_runpath] = true;
+            $ok = false;
+        }
+        if (!$ok || !rename($tmpindex, $index)) {
+            logmsg(LOG_DEBUG, "Could not build index of test answer '$output'");
+            if (file_exists($tmpindex)) {
+                unlink($tmpindex);
+            }
+        }
+    }
+
+    /**
+     * Build the command to run the output validator under runguard.
+     *
+     * @param CompareConfig $compare_config
+     * @param string[] $cpuset
+     * @return string[]
+     */
+    private function compareCommand(
+        string $compare_runpath,
+        ?string $compare_args,
+        array $compare_config,
+        array $cpuset,
+        string $scripttimelimit,
+        string $answer,
+        string $feedbackdir,
+        ?string $user = null
+    ): array {
+        $scriptmemlimit = (string)$compare_config['script_memory_limit'];
+        $scriptfilelimit = (string)$compare_config['script_filesize_limit'];
+        // TODO: Perhaps we should change this in the database to be an array of args?
+        $orig_compare_args = [];
+        if ($compare_args !== null && strlen($compare_args) > 0) {
+            $orig_compare_args = explode(' ', $compare_args);
+        }
+
+        return array_merge(
+            ['sudo', '-n'],
+            [BINDIR . "/runguard"],
+            $cpuset,
+            [
+                "--user=" . ($user ?? $this->runuser),
+                "--group=$this->rungroup",
+                "-m", $scriptmemlimit,
+                "-t", $scripttimelimit,
+                "-f", $scriptfilelimit,
+                "-s", $scriptfilelimit,
+                "--no-core",
+                "-M", "compare.meta",
+                "--",
+                $compare_runpath,
+                "testdata.in",
+                $answer,
+                $feedbackdir,
+            ],
+            $orig_compare_args,
+        );
+    }
+
+    /**
+     * Check the output of a submission with a resident output validator,
+     * which is started once and then kept running to check the outputs of
+     * later testcases too, see RESIDENT_VALIDATOR and run_validator() in
+     * validate.h. Writes 'compare.meta' itself, as the validator keeps
+     * running under runguard, with the CPU time and memory that the
+     * validator reports for the check, if it does.
+     *
+     * Returns the exit code of the validator, or null if it could not be
+     * used and the validator has to be run as a separate process instead:
+     * when it does not support resident mode, but also when it died or did
+     * not answer in time. Without a separate validator user, it runs as
+     * the same user as the submissions, so a submission might have killed
+     * or stopped it; we do not want such a submission to get the validator
+     * disabled.
+     *
+     * @param CompareConfig $compare_config
+     * @param string[] $cpuset
+     */
+    private function runResidentCompare(
+        string $compare_runpath,
+        ?string $compare_args,
+        array $compare_config,
+        array $cpuset,
+        string $realWorkdir
+    ): ?int {
+        $command = array_merge(
+            ['sudo', '-n'],
+            [BINDIR . "/runguard"],
+            $cpuset,
+            [
+                "--user=" . ($this->streamuser ?? $this->runuser),
+                "--group=$this->rungroup",
+                "-m", (string)$compare_config['script_memory_limit'],
+                "-f", (string)$compare_config['script_filesize_limit'],
+                "--no-core",
+                "--",
+                $compare_runpath,
+                "--resident",
+            ]
+        );
+        $key = implode(' ', array_map(dj_escapeshellarg(...), $command));
+        if (isset($this->nonResidentValidators[$key])) {
+            return null;
+        }
+
+        if (isset($this->residentValidators[$key])) {
+            // Move it to the end, as most recently used.
+            $validator = $this->residentValidators[$key];
+            unset($this->residentValidators[$key]);
+            $this->residentValidators[$key] = $validator;
+        } else {
+            $validator = $this->startResidentValidator($key, $command, dirname($compare_runpath));
+            if ($validator === null) {
+                $this->nonResidentValidators[$key] = true;
+                return null;
+            }
+        }
+
+        // The validator writes to these as the run user.
+        foreach (['compare.tmp', 'compare.err'] as $file) {
+            if (!touch($file) || !chmod($file, 0666)) {
+                logmsg(LOG_WARNING, "Could not create '$file' for the resident validator.");
+                return null;
+            }
+        }
+
+        $args = [
+            "$realWorkdir/compare.tmp",
+            "$realWorkdir/compare.err",
+            "$realWorkdir/testdata.in",
+            "$realWorkdir/testdata.out",
+            "$realWorkdir/feedback/",
+            "$realWorkdir/program.out",
+        ];
+        if ($compare_args !== null && strlen($compare_args) > 0) {
+            $args = array_merge($args, explode(' ', $compare_args));
+        }
+        $payload = implode("\0", $args);
+
+        $start = microtime(true);
+        $deadline = $start + (float)$compare_config['script_timelimit'];
+        $result = false;
+        if (fwrite($validator['requests'], strlen($payload) . "\n" . $payload) !== false &&
+            fflush($validator['requests'])) {
+            $result = $this->readLineUntil($validator['results'], $deadline);
+        }
+        $walltime = microtime(true) - $start;
+
+        if ($result === false || !preg_match('/^(-?[0-9]+)(?: ([0-9]+\.[0-9]+) ([0-9]+))?$/', $result, $matches)) {
+            logmsg(LOG_WARNING, sprintf(
+                "Resident validator '%s' did not answer within %.3fs, checking with a separate process.",
+                $compare_runpath, $walltime
+            ));
+            $this->stopResidentValidator($key);
+            return null;
+        }
+
+        $exitcode = (int)$matches[1];
+        $meta = sprintf("exitcode: %d\nwall-time: %.3f\n", $exitcode, $walltime);
+        if (isset($matches[2])) {
+            $meta .= "cpu-time: $matches[2]\nmemory-bytes: $matches[3]\n";
+        }
+        file_put_contents('compare.meta', $meta . "time-used: wall-time\nresident: true\n");
+        return $exitcode;
+    }
+
+    /**
+     * Start a resident output validator and check that it supports resident
+     * mode. Returns null if it does not.
+     *
+     * @param string[] $command
+     * @return ?array{process: resource, requests: resource, results: resource}
+     */
+    private function startResidentValidator(string $key, array $command, string $dir): ?array
+    {
+        if (count($this->residentValidators) >= self::MAX_RESIDENT_VALIDATORS) {
+            $this->stopResidentValidator(array_key_first($this->residentValidators));
+        }
+
+        logmsg(LOG_DEBUG, "Starting resident validator: $key");
+        $process = proc_open($command, [
+            self::FD_STDIN  => ['pipe', 'r'],
+            self::FD_STDOUT => ['pipe', 'w'],
+            self::FD_STDERR => ['file', TMPDIR . '/resident-validators.err', 'a'],
+        ], $pipes, $dir);
+        if (!is_resource($process)) {
+            logmsg(LOG_WARNING, "Failed to start resident validator: $key");
+            return null;
+        }
+        stream_set_blocking($pipes[self::FD_STDOUT], false);
+        $validator = [
+            'process' => $process,
+            'requests' => $pipes[self::FD_STDIN],
+            'results' => $pipes[self::FD_STDOUT],
+        ];
+
+        $handshake = $this->readLineUntil($validator['results'], microtime(true) + self::RESIDENT_STARTUP_TIMEOUT_SEC);
+        if ($handshake . "\n" !== self::RESIDENT_HANDSHAKE) {
+            logmsg(LOG_INFO, "Output validator does not support resident mode: $key");
+            $this->closeResidentValidator($validator);
+            return null;
+        }
+
+        $this->residentValidators[$key] = $validator;
+        return $validator;
+    }
+
+    /**
+     * Read a line from non-blocking stream $stream without the newline.
+     * Returns false on end of file, error or when the line is not complete
+     * at time $deadline.
+     *
+     * @param resource $stream
+     */
+    private function readLineUntil($stream, float $deadline): string|false
+    {
+        $line = '';
+        while (!str_contains($line, "\n")) {
+            $timeout = $deadline - microtime(true);
+            if ($timeout <= 0) {
+                return false;
+            }
+            $read = [$stream];
+            $write = $except = null;
+            $ready = stream_select($read, $write, $except, (int)$timeout, (int)(fmod($timeout, 1) * 1000000));
+            if ($ready === false) {
+                return false;
+            }
+            if ($ready === 0) {
+                continue;
+            }
+            $data = fread($stream, 1024);
+            if ($data === false || ($data === '' && feof($stream))) {
+                return false;
+            }
+            $line .= $data;
+        }
+        return substr($line, 0, strpos($line, "\n"));
+    }
+
+    /**
+     * @param array{process: resource, requests: resource, results: resource} $validator
+     */
+    private function closeResidentValidator(array $validator): void
+    {
+        // On end of file, the validator exits by itself. If it does not,
+        // runguard kills it on SIGTERM.
+        fclose($validator['requests']);
+        if (proc_get_status($validator['process'])['running']) {
+            usleep(10000);
+            if (proc_get_status($validator['process'])['running']) {
+                proc_terminate($validator['process']);
+            }
+        }
+        fclose($validator['results']);
+        proc_close($validator['process']);
+    }
+
+    private function stopResidentValidator(string $key): void
+    {
+        logmsg(LOG_DEBUG, "Stopping resident validator: $key");
+        $this->closeResidentValidator($this->residentValidators[$key]);
+        unset($this->residentValidators[$key]);
+    }
+
+    private function stopResidentValidators(): void
+    {
+        foreach (array_keys($this->residentValidators) as $key) {
+            $this->stopResidentValidator($key);
+        }
+    }
+
+    /**
+     * Return the socket of the zygote of the judging in $workdir, starting
+     * it when needed, or null if there is none. A zygote is a process of
+     * the language runtime that has already initialized itself, and forks
+     * a process for each testcase that runs the submission, see the
+     * --zygote option of runguard. It runs under runguard with the same
+     * restrictions as the submission, except for the time limits.
+     * Executables support this by building a 'zygote' program next to
+     * 'program', that is started as 'zygote <socket>'.
+     *
+     * @param string[] $cpuset
+     */
+    private function zygoteSocket(string $workdir, array $cpuset, int $proclimit, int $memlimit, int $filelimit): ?string
+    {
+        if ($this->zygote !== null && $this->zygote['workdir'] === $workdir) {
+            // The submission may have killed it, as it runs as the same user.
+            if (proc_get_status($this->zygote['process'])['running']) {
+                return $this->zygote['socket'];
+            }
+            logmsg(LOG_INFO, "Zygote of '$workdir' exited, restarting it.");
+        }
+        $this->stopZygote();
+
+        if (!is_executable("$workdir/compile/zygote")) {
+            return null;
+        }
+
+        // The zygote runs as the run user, so it needs a writable directory
+        // for its socket.
+        $socketdir = "$workdir/zygote";
+        $socket = "$socketdir/zygote.sock";
+        if ((!is_dir($socketdir) && !mkdir($socketdir)) || !chmod($socketdir, 0777)) {
+            logmsg(LOG_WARNING, "Could not create '$socketdir' for the zygote.");
+            return null;
+        }
+        if (file_exists($socket)) {
+            unlink($socket);
+        }
+
+        $command = array_merge(
+            ['sudo', '-n', BINDIR . "/runguard"],
+            $cpuset,
+            [
+                '-r', $workdir,
+                "--nproc=$proclimit",
+                "--no-core",
+                "--user=$this->runuser",
+                "--group=$this->rungroup",
+                "--memsize=$memlimit",
+                "--filesize=$filelimit",
+                "--",
+                "/compile/zygote",
+                "/zygote/zygote.sock",
+            ]
+        );
+        logmsg(LOG_DEBUG, "Starting zygote: " . implode(' ', array_map(dj_escapeshellarg(...), $command)));
+        $process = proc_open($command, [
+            self::FD_STDIN  => ['file', '/dev/null', 'r'],
+            self::FD_STDOUT => ['file', '/dev/null', 'w'],
+            self::FD_STDERR => ['file', "$workdir/zygote.err", 'w'],
+        ], $pipes);
+        if (!is_resource($process)) {
+            logmsg(LOG_WARNING, "Failed to start zygote in '$workdir'.");
+            return null;
+        }
+        $this->zygote = ['workdir' => $workdir, 'process' => $process, 'socket' => $socket];
+
+        $deadline = microtime(true) + self::ZYGOTE_STARTUP_TIMEOUT_SEC;
+        while (!file_exists($socket)) {
+            if (!proc_get_status($process)['running'] || microtime(true) > $deadline) {
+                logmsg(LOG_WARNING, "Zygote in '$workdir' did not start, see '$workdir/zygote.err'.");
+                $this->stopZygote();
+                return null;
+            }
+            usleep(10000);
+        }
+        return $socket;
+    }
+
+    private function stopZygote(): void
+    {
+        if ($this->zygote === null) {
+            return;
+        }
+        // Runguard kills the zygote on SIGTERM.
+        logmsg(LOG_DEBUG, "Stopping zygote in '" . $this->zygote['workdir'] . "'.");
+        proc_terminate($this->zygote['process']);
+        proc_close($this->zygote['process']);
+        $this->zygote = null;
+    }
+
+    /**
+     * Run the submission and the output validator concurrently.
+     *
+     * The run script writes the output of the submission to the FIFO
+     * 'program.fifo', from which it is copied both to 'program.out' and to
+     * the validator. When the validator rejects the output while the
+     * submission is still running, the submission is terminated and
+     * $stoppedEarly is set. The output limit is enforced here by cutting the
+     * stream, since the file size limit of runguard does not apply to a FIFO.
+     *
+     * @param string[] $run_args
+     * @param string[] $compare_cmd
+     */
+    private function runStreamingCompare(
+        array $run_args,
+        array $compare_cmd,
+        int $outputLimit,
+        ?int &$compareExitcode,
+        bool &$stoppedEarly
+    ): bool {
+        $fifo = 'program.fifo';
+        if (file_exists($fifo)) {
+            unlink($fifo);
+        }
+        if (!posix_mkfifo($fifo, 0600)) {
+            logmsg(LOG_WARNING, "Could not create FIFO '$fifo'.");
+            return false;
+        }
+
+        // Pass the commands as arrays, so they are executed directly and
+        // signals reach them instead of an intermediate shell.
+        logmsg(LOG_DEBUG, "Executing command: " . implode(' ', array_map(dj_escapeshellarg(...), $run_args)));
+        $run = proc_open($run_args, [
+            self::FD_STDIN  => ['file', '/dev/null', 'r'],
+            self::FD_STDOUT => ['file', '/dev/null', 'w'],
+            self::FD_STDERR => ['file', 'runguard.err', 'w'],
+        ], $pipes);
+        if (!is_resource($run)) {
+            logmsg(LOG_ERR, "Failed to start run script.");
+            unlink($fifo);
+            return false;
+        }
+
+        // The shell opens the FIFO, so we don't block here if the run script
+        // has not opened it yet. 'tee -p' keeps writing 'program.out' when
+        // the validator exits before reading all output.
+        $relay = proc_open(
+            ['sh', '-c', 'head -c "$1" < "$2" | tee -p program.out', 'sh', (string)$outputLimit, $fifo],
+            [
+                self::FD_STDIN  => ['file', '/dev/null', 'r'],
+                self::FD_STDOUT => ['pipe', 'w'],
+                self::FD_STDERR => ['file', '/dev/null', 'w'],
+            ],
+            $relayPipes
+        );
+        $compare = false;
+        if (is_resource($relay)) {
+            logmsg(LOG_DEBUG, "Executing command: " . implode(' ', array_map(dj_escapeshellarg(...), $compare_cmd)));
+            $compare = proc_open($compare_cmd, [
+                self::FD_STDIN  => $relayPipes[self::FD_STDOUT],
+                self::FD_STDOUT => ['file', 'compare.tmp', 'w'],
+                self::FD_STDERR => ['file', 'compare.err', 'w'],
+            ], $pipes);
+            fclose($relayPipes[self::FD_STDOUT]);
+        }
+        if (!is_resource($compare)) {
+            logmsg(LOG_ERR, "Failed to start output validator.");
+            proc_terminate($run);
+        }
+
+        // Note that proc_get_status() only reports the exit code once.
+        $runExitcode = $compareExitcode = null;
+        while ($runExitcode === null) {
+            $status = proc_get_status($run);
+            if (!$status['running']) {
+                $runExitcode = $status['exitcode'];
+                break;
+            }
+            if (is_resource($compare) && $compareExitcode === null) {
+                $status = proc_get_status($compare);
+                if (!$status['running']) {
+                    $compareExitcode = $status['exitcode'];
+                    if ($compareExitcode === self::COMPARE_EXITCODE_WRONG_ANSWER) {
+                        logmsg(LOG_DEBUG, "Output validator rejected the output, stopping the submission");
+                        proc_terminate($run);
+                        $stoppedEarly = true;
+                    }
+                }
+            }
+            usleep(10000);
+        }
+        proc_close($run);
+
+        // If the run script never opened the FIFO, the relay would block
+        // forever opening it. Opening it read-write does not block on Linux
+        // and signals end of file to the relay once we close it again.
+        $unblock = fopen($fifo, 'r+');
+        if ($unblock !== false) {
+            fclose($unblock);
+        }
+        if (is_resource($relay)) {
+            proc_close($relay);
+        }
+        unlink($fifo);
+
+        if (!is_resource($compare)) {
+            return false;
+        }
+        if ($compareExitcode === null) {
+            $compareExitcode = proc_close($compare);
+        } else {
+            proc_close($compare);
+        }
+        logmsg(LOG_DEBUG, "Run script exited with $runExitcode, output validator with $compareExitcode");
+        return true;
+    }
+
     /**
      * @param array{cpu: array{0: float, 1: float}, wall: array{0: float, 1: float}} $timelimit
      * @param RunConfig $run_config
@@ -1999,10 +2612,14 @@ class JudgeDaemon
                 }
             }
 
+            // Stream the output of the submission directly to the output
+            // validator, see runStreamingCompare().
+            $stream_compare = STREAM_COMPARE && $this->streamuser !== null && !$combined_run_compare;
+
             logmsg(LOG_DEBUG, "Running program");
             $run_args = [
                 $run_runpath,
-                'testdata.in', 'program.out'
+                'testdata.in', $stream_compare ? 'program.fifo' : 'program.out'
             ];
             if ($combined_run_compare) {
                 // A combined run and compare script may now already need the
@@ -2030,6 +2647,9 @@ class JudgeDaemon
             $cpuset = is_null($this->daemonid) ? [] : ['-P', $this->daemonid];
 
             $runguard_args = [BINDIR . "/runguard"];
+            if (CGROUP_RECLAIM) {
+                $runguard_args[] = '--reclaim';
+            }
             if (CREATE_WRITABLE_TEMP_DIR) {
                 $runguard_args[] = '-V';
                 $runguard_args[] = "TMPDIR=$prefix/write_tmp";
@@ -2039,6 +2659,20 @@ class JudgeDaemon
                 $runguard_args[] = '-V';
                 $runguard_args[] = "DEBUG=$debug";
             }
+            // Join the namespaces pinned for this judgedaemon by
+            // create_cgroups, which is faster than creating new ones.
+            $namespacedir = RUNDIR . '/namespaces/' . ($this->daemonid ?? 'default');
+            if (is_dir($namespacedir)) {
+                $runguard_args[] = "--namespaces=$namespacedir";
+            }
+            // The zygote has the environment of the first testcase, so it
+            // cannot be used with a temporary directory per testcase.
+            if (ZYGOTE && !$combined_run_compare && !CREATE_WRITABLE_TEMP_DIR && !$debug) {
+                $socket = $this->zygoteSocket(dirname($realWorkdir, 2), $cpuset, $proclimit, $memlimit, $filelimit);
+                if ($socket !== null) {
+                    $runguard_args[] = "--zygote=$socket";
+                }
+            }
 
             $run_args = array_merge(
                 $run_args,
@@ -2063,7 +2697,47 @@ class JudgeDaemon
                 ]
             );
 
-            $this->runCommandSafe($run_args, $exitcode, log_nonzero_exitcode: false, stderr_target: "runguard.err");
+            $scripttimelimit = (string)$compare_config['script_timelimit'];
+            $stoppedEarly = false;
+
+            if ($stream_compare) {
+                logmsg(LOG_DEBUG, "Running program and comparing output concurrently");
+
+                // The validator runs as a separate user, so that the
+                // submission cannot signal, trace or look into it through
+                // /proc. Its feedback directory is writable for others and
+                // must not be reachable from within the chroot: move it out
+                // (it may already contain files of an earlier pass) and back
+                // in afterwards.
+                $feedbackdir = dirname($realWorkdir, 3) . '/' . basename(dirname($realWorkdir, 2)) . '-'
+                    . basename(dirname($realWorkdir)) . '-' . basename($realWorkdir) . '-feedback';
+                if (is_dir('feedback') && !rename('feedback', $feedbackdir)) {
+                    logmsg(LOG_WARNING, "Could not move 'feedback' to '$feedbackdir'.");
+                    return Verdict::INTERNAL_ERROR;
+                }
+                if (!$this->prepareFeedbackDir($feedbackdir)) {
+                    return Verdict::INTERNAL_ERROR;
+                }
+
+                // The validator is started together with the submission, so
+                // its wall time limit has to include the runtime of the latter.
+                $compare_cmd = $this->compareCommand(
+                    $compare_runpath, $compare_args, $compare_config, $cpuset,
+                    (string)((int)$scripttimelimit + (int)ceil($timelimit['wall'][1])),
+                    $output, "$feedbackdir/", $this->streamuser
+                );
+                $ok = $this->runStreamingCompare($run_args, $compare_cmd, $filelimit * 1024, $exitcode, $stoppedEarly);
+
+                if (!rename($feedbackdir, 'feedback')) {
+                    logmsg(LOG_WARNING, "Could not move '$feedbackdir' back to 'feedback'.");
+                    return Verdict::INTERNAL_ERROR;
+                }
+                if (!$ok) {
+                    return Verdict::INTERNAL_ERROR;
+                }
+            } else {
+                $this->runCommandSafe($run_args, $exitcode, log_nonzero_exitcode: false, stderr_target: "runguard.err");
+            }
 
             if (CREATE_WRITABLE_TEMP_DIR) {
                 // Revoke access to the TMPDIR as security measure
@@ -2080,70 +2754,43 @@ class JudgeDaemon
                 }
             }
 
-            $scripttimelimit = (string)$compare_config['script_timelimit'];
-
-            if (!$combined_run_compare) {
+            if (!$combined_run_compare && !$stream_compare) {
                 logmsg(LOG_DEBUG, "Comparing output");
 
                 if (!copy($output, "$realWorkdir/testdata.out")) {
                     logmsg(LOG_WARNING, "Could not copy '$output' to '$realWorkdir/testdata.out'.");
                     return Verdict::INTERNAL_ERROR;
                 }
-
-                logmsg(LOG_DEBUG, "Starting compare script '" . $compare_runpath ."'");
-
-                if (!is_dir('feedback')) {
-                    if (!mkdir('feedback', 0777, true)) {
-                        logmsg(LOG_WARNING, "Could not create 'feedback'.");
+                if (is_readable("$output.idx")) {
+                    if (!copy("$output.idx", "$realWorkdir/testdata.out.idx")) {
+                        logmsg(LOG_WARNING, "Could not copy '$output.idx' to '$realWorkdir/testdata.out.idx'.");
                         return Verdict::INTERNAL_ERROR;
                     }
-                }
-                // We need to set permissions explicitly for two reasons:
-                // `umask` might block them from being 0777, and for multi-pass problems there is the implicit contract
-                // of keeping files around between passes. This is ugly, but what the spec currently dictates.
-                // Cannot use `chmod` here directly because of recursion.
-                if (!$this->runCommandSafe(
-                    [
-                        'chmod',
-                        '-R',
-                        'go+w',
-                        'feedback',
-                    ]
-                )) {
-                    logmsg(LOG_WARNING, "Could not chmod 'feedback' to go+w.");
+                } elseif (file_exists("$realWorkdir/testdata.out.idx") && !unlink("$realWorkdir/testdata.out.idx")) {
+                    // Do not leave the index of another answer around.
+                    logmsg(LOG_WARNING, "Could not remove stale '$realWorkdir/testdata.out.idx'.");
                     return Verdict::INTERNAL_ERROR;
                 }
 
-                $scriptmemlimit = (string)$compare_config['script_memory_limit'];
-                $scriptfilelimit = (string)$compare_config['script_filesize_limit'];
-                // TODO: Perhaps we should change this in the database to be an array of args?
-                $orig_compare_args = [];
-                if ($compare_args !== null && strlen($compare_args) > 0) {
-                    $orig_compare_args = explode(' ', $compare_args);
+                logmsg(LOG_DEBUG, "Starting compare script '" . $compare_runpath ."'");
+
+                if (!$this->prepareFeedbackDir('feedback')) {
+                    return Verdict::INTERNAL_ERROR;
                 }
 
-                $compare_args = array_merge(
-                    $gainroot,
-                    [BINDIR . "/runguard"],
-                    $cpuset,
-                    [
-                        "--user=$runuser",
-                        "--group=$rungroup",
-                        "-m", $scriptmemlimit,
-                        "-t", $scripttimelimit,
-                        "-f", $scriptfilelimit,
-                        "-s", $scriptfilelimit,
-                        "--no-core",
-                        "-M", "compare.meta",
-                        "--",
-                        $compare_runpath,
-                        "testdata.in",
-                        "testdata.out",
-                        "feedback/",
-                    ],
-                    $orig_compare_args,
-                );
-                $this->runCommandSafe($compare_args, $exitcode, log_nonzero_exitcode: false, stdin_source: "program.out", stdout_target: "compare.tmp", stderr_target: "compare.err");
+                $exitcode = null;
+                if (RESIDENT_VALIDATOR) {
+                    $exitcode = $this->runResidentCompare(
+                        $compare_runpath, $compare_args, $compare_config, $cpuset, $realWorkdir
+                    );
+                }
+                if ($exitcode === null) {
+                    $compare_cmd = $this->compareCommand(
+                        $compare_runpath, $compare_args, $compare_config, $cpuset,
+                        $scripttimelimit, 'testdata.out', 'feedback/'
+                    );
+                    $this->runCommandSafe($compare_cmd, $exitcode, log_nonzero_exitcode: false, stdin_source: "program.out", stdout_target: "compare.tmp", stderr_target: "compare.err");
+                }
             }
 
             $this->runCommandSafe(
@@ -2215,6 +2862,12 @@ class JudgeDaemon
             }
             logmsg(LOG_DEBUG, "checking program exit status");
             $program_meta_ini = $this->readMetadata('program.meta');
+            // The submission may have stopped the zygote, as it runs as the
+            // same user; the zygote is still running, but does not answer.
+            if (isset($program_meta_ini['zygote-failed']) && $this->zygote !== null) {
+                logmsg(LOG_INFO, "Zygote of '" . $this->zygote['workdir'] . "' did not answer, stopping it.");
+                $this->stopZygote();
+            }
             if (isset($program_meta_ini['internal-error'])) {
                 $this->handleMetaInternalError($judgetaskid, $program_meta_ini);
                 return Verdict::INTERNAL_ERROR;
@@ -2237,11 +2890,12 @@ class JudgeDaemon
                 combinedRunCompare: $combined_run_compare,
                 programOutSize: $programOutSize === false ? 0 : $programOutSize,
                 compareTimedOut: $compareTimedOut,
+                stoppedEarly: $stoppedEarly,
             );
             $verdict = $this->determineVerdict($verdictInput);
 
             // Log appropriate message based on verdict
-            $verdictMessage = $this->getVerdictMessage($verdict, $programMeta, $compareMeta, $combined_run_compare, $filelimit);
+            $verdictMessage = $this->getVerdictMessage($verdict, $programMeta, $compareMeta, $combined_run_compare, $filelimit, $stoppedEarly);
             if ($verdictMessage !== null) {
                 appendToFile("system.out", $verdictMessage);
             }
@@ -2284,6 +2938,10 @@ class JudgeDaemon
                     }
                 }
 
+                if (file_exists("$realWorkdir/testdata.out.idx")) {
+                    unlink("$realWorkdir/testdata.out.idx");
+                }
+
                 // Remove access to workdir for next runs
                 chmod($realWorkdir, 0700);
             }
@@ -2363,6 +3021,10 @@ class JudgeDaemon
             }
         }
 
+        if (ANSWER_INDEX && !$combined_run_compare) {
+            $this->buildAnswerIndex($compare_runpath, $tcfile['output'], $compare_config);
+        }
+
         $hardtimelimit = $run_config['time_limit']
             + overshoot_time($run_config['time_limit'], $overshoot)
             + $run_config['overshoot'];
@@ -2423,6 +3085,11 @@ class JudgeDaemon
             // Use PHP-native hardlinks instead of forking 'cp -PRl' per file.
             $this->hardlinkRecursive("$workdir/compile", $programdir);
 
+            // An interactive validator may run the remaining passes against
+            // the same instance of itself, see run-interactive.sh.
+            if ($combined_run_compare && $passLimit > 1) {
+                putenv('PASS_LIMIT=' . ($passLimit - $passCnt + 1));
+            }
             $verdict = $this->testcaseRunInternal(
                 $input,
                 $output,
@@ -2436,6 +3103,7 @@ class JudgeDaemon
                 $compare_config,
                 $judgeTask['judgetaskid']
             );
+            putenv('PASS_LIMIT');
 
             $result = str_replace('_', '-', strtolower($verdict->name));
             if ($result === 'internal-error') {
@@ -2478,6 +3146,15 @@ class JudgeDaemon
                 return false;
             }
 
+            if ($combined_run_compare && $passLimit > 1) {
+                $compareMeta = $this->readMetadata($passdir . '/compare.meta');
+                $residentPasses = (int)($compareMeta['passes'] ?? 1);
+                if ($residentPasses > 1) {
+                    $passCnt += $residentPasses - 1;
+                    logmsg(LOG_INFO, "    🔄 Validator kept running up to pass $passCnt");
+                }
+            }
+
             $new_judging_run = [
                 'runresult' => urlencode($result),
                 'start_time' => urlencode((string)$startTime),
@@ -25,6 +25,17 @@
 #
 # The jury program should exit with exitcode 42 if the submissions is accepted,
 # 43 otherwise.
+#
+# For multi-pass problems the judgedaemon sets PASS_LIMIT to the number of
+# passes left. The jury program may then keep running across passes by
+# appending a line to 'nextpass.resident' in <feedbackdir> instead of writing
+# 'nextpass.in', see runpipe.
+#
+# If the build script also produced a shared object 'run.so' implementing
+# the interface of runpipe_interactor.h (installed in DJ_LIBJUDGEDIR), it is
+# loaded into runpipe instead of running 'runjury' as a separate process.
+# This saves many context switches for problems with lots of short messages.
+# It is not used for multi-pass problems.
 
 TESTIN="$1";  shift
 PROGOUT="$1"; shift
@@ -34,6 +45,13 @@ FEEDBACK="$1"; shift
 
 MYDIR="$(dirname $0)"
 
+RUNJURY="$MYDIR/runjury"
+INPROCESS=""
+if [ -f "$MYDIR/run.so" ] && [ -z "$PASS_LIMIT" ]; then
+	RUNJURY="$MYDIR/run.so"
+	INPROCESS=1
+fi
+
 # Run the program while redirecting its stdin/stdout to 'runjury' via
 # 'runpipe'. Note that "$@" expands to separate, quoted arguments.
-exec ../../dj-bin/runpipe ${DEBUG:+-v} -M "$META" -o "$PROGOUT" "$MYDIR/runjury" "$TESTIN" "$TESTOUT" "$FEEDBACK" = "$@"
+exec ../../dj-bin/runpipe ${DEBUG:+-v} ${INPROCESS:+-I} ${PASS_LIMIT:+-p "$PASS_LIMIT" -F "$FEEDBACK"} -M "$META" -o "$PROGOUT" "$RUNJURY" "$TESTIN" "$TESTOUT" "$FEEDBACK" = "$@"
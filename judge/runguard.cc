@@ -25,12 +25,41 @@
    has passed, followed by a SIGKILL after 'killdelay'. The program is
    considered to have finished when the main program thread exits. At
    that time any children still running are killed.
+
+   With the zygote option, the command is not executed, but a process
+   is requested from a zygote: a process of a language runtime that was
+   started earlier by another runguard with the same restrictions, and
+   that has already initialized itself. It forks a process for the
+   command, which we put into our cgroup before it is allowed to run,
+   and reports its exit status. The protocol over the SOCK_SEQPACKET
+   socket of the zygote is, one message each:
+
+     runguard -> zygote: "run\0<cpulimit>\0<command>\0<arg>..." with
+                         stdin, stdout and stderr attached (SCM_RIGHTS)
+     zygote -> runguard: "<pid> <startup>" once the process has called
+                         setsid() and set up its file descriptors and
+                         RLIMIT_CPU, where <startup> is how long it took
+                         the zygote to start in seconds
+     runguard -> zygote: "go" to let the process run the command
+     zygote -> runguard: "<status>", the wait status of the process
+
+   The zygote must only accept connections from root, and its processes
+   are checked to be its children running as the run user.
+   Replies are waited for at most zygote_timeout; without one, the
+   command is executed directly or killed, and `zygote-failed' is
+   written to the metadata, so that the caller can restart the zygote.
+
+   With the namespaces option, the command joins the network and UTS
+   namespaces bind mounted as `net' and `uts' in the given directory by
+   create_cgroups, instead of getting new ones. These must not be used
+   by more than one runguard at a time.
  */
 
 #include "config.h"
 
 #include "lib.error.hpp"
 #include "lib.misc.h"
+#include "lib.cgroup.hpp"
 
 /* Some system/site specific config: VALID_USERS, CHROOT_PREFIX */
 #include "runguard-config.h"
@@ -44,6 +73,8 @@
 #include <sys/time.h>
 #include <sys/times.h>
 #include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/un.h>
 #include <cerrno>
 #include <fcntl.h>
 #include <csignal>
@@ -62,7 +93,6 @@
 #include <cmath>
 #include <climits>
 #include <cinttypes>
-#include <libcgroup.h>
 #include <sched.h>
 #include <sys/sysinfo.h>
 #include <algorithm>
@@ -103,6 +133,10 @@ const int hard_timelimit = 2;
 
 const struct timespec killdelay = { 0, 100000000L }; /* 0.1 seconds */
 
+/* Maximum time to wait for a reply of the zygote. The command runs as the
+   same user as the zygote, so it can stop the zygote from replying. */
+const struct timeval zygote_timeout = { 2, 0 };
+
 extern int verbose;
 
 std::string_view progname;
@@ -113,10 +147,13 @@ char  *rootchdir;
 char  *stdoutfilename;
 char  *stderrfilename;
 char  *metafilename;
+char  *zygotepath;
+char  *namespacedir;
 std::vector<std::string> environment_variables;
 FILE  *metafile;
 
 char  cgroupname[255];
+cgroup_v2 cg;
 const char *cpuset;
 
 char *runuser;
@@ -134,11 +171,18 @@ bool limit_streamsize;
 bool outputmeta;
 int outputtimetype;
 bool no_coredump;
+bool reclaim_cache;
 bool preserve_environment;
 bool in_error_handling = false;
 int show_help;
 int show_version;
-pid_t runpipe_pid = -1;
+int runpipe_fd = -1;
+std::string runpipe_status;
+int zygote_fd = -1;
+bool zygote_failed;     /* whether the zygote could not be used or lost */
+double zygote_startup;  /* startup time of the zygote as reported by it */
+double zygote_forktime; /* time it took to get the process from the zygote */
+double zygote_usertime, zygote_systime;
 
 double walltimelimit[2], cputimelimit[2]; /* in seconds, soft and hard limits */
 int walllimit_reached, cpulimit_reached; /* 1=soft, 2=hard, 3=both limits reached */
@@ -178,7 +222,10 @@ struct option const long_opts[] = {
 	{"environment",no_argument,       nullptr,         'E'},
 	{"variable",   required_argument, nullptr,         'V'},
 	{"outmeta",    required_argument, nullptr,         'M'},
-	{"runpipepid", required_argument, nullptr,         'U'},
+	{"runpipe",    required_argument, nullptr,         'U'},
+	{"reclaim",    no_argument,       nullptr,         'R'},
+	{"zygote",     required_argument, nullptr,         'Z'},
+	{"namespaces", required_argument, nullptr,         'N'},
 	{"verbose",    no_argument,       nullptr,         'v'},
 	{"quiet",      no_argument,       nullptr,         'q'},
 	{"help",       no_argument,       &show_help,       1 },
@@ -188,6 +235,7 @@ struct option const long_opts[] = {
 
 template<typename... Args>
 void write_meta(const std::string& key, std::format_string<Args...> fmt, Args&&... args);
+void notify_runpipe();
 
 // These functions are called from signal handlers, so they
 // must only call async-signal-safe functions.
@@ -235,25 +283,15 @@ void die(int errnum, std::format_string<Args...> fmt, Args&&... args)
 	if (errnum == 0) {
 		errstr += ": unknown error";
 	} else {
-		/* Special case libcgroup error codes. */
-		if ( errnum==ECGOTHER ) {
-			errstr += ": libcgroup";
-			errnum = errno;
-		}
-		// The upper bound depends on the libcgroup version, we got the value from
-		// https://github.com/libcgroup/libcgroup/blob/b26f58ec3fce95f81b3c0dac4ea44d1c5793670c/include/libcgroup/error.h#L79
-		if ( errnum>=ECGROUPNOTCOMPILED && errnum<=50031 ) {
-			errstr += ": ";
-			errstr += cgroup_strerror(errnum);
-		} else {
-			errstr += ": ";
-			errstr += strerror(errnum);
-		}
+		errstr += ": ";
+		errstr += strerror(errnum);
 	}
 
+	log_flush();
 	std::cerr << errstr << std::endl;
 
 	write_meta("internal-error","{}", errstr);
+	notify_runpipe();
 	if ( outputmeta && metafile != nullptr && fclose(metafile)!=0 ) {
 		fprintf(stderr,"\nError writing to metafile '%s'.\n",metafilename);
 	}
@@ -281,23 +319,37 @@ void die(int errnum, std::format_string<Args...> fmt, Args&&... args)
 template<typename... Args>
 void write_meta(const std::string& key, std::format_string<Args...> fmt, Args&&... args)
 {
+	if ( !outputmeta && runpipe_fd<0 ) return;
+
+	std::string value;
+	try {
+		value = std::format(fmt, std::forward<Args>(args)...);
+	} catch (const std::exception& e) {
+		outputmeta = false;
+		die(0, "Error formatting meta value for key {}: {}", key, e.what());
+	}
+
+	/* Also collect the metadata to report it to runpipe. */
+	if ( runpipe_fd>=0 ) runpipe_status += key + ": " + value + "\n";
+
 	if ( !outputmeta ) return;
 
-	if ( fprintf(metafile,"%s: ",key.c_str())<=0 ) {
+	if ( fprintf(metafile,"%s: %s\n",key.c_str(),value.c_str())<=0 ) {
 		outputmeta = false;
 		die(0,"cannot write to file `{}'",metafilename);
 	}
+}
 
-	try {
-		std::string value = std::format(fmt, std::forward<Args>(args)...);
-		if ( fprintf(metafile, "%s\n", value.c_str()) <= 0 ) {
-			outputmeta = false;
-			die(0,"cannot write to file `{}'", metafilename);
-		}
-	} catch (const std::exception& e) {
-		outputmeta = false;
-		die(0, "Error formatting meta value for key {}: {}", key, e.what());
+/* Send the collected metadata to runpipe as a single message. */
+void notify_runpipe()
+{
+	if ( runpipe_fd<0 ) return;
+
+	if ( send(runpipe_fd, runpipe_status.data(), runpipe_status.size(), 0)<0 ) {
+		warning(errno, "sending status to runpipe");
 	}
+	close(runpipe_fd);
+	runpipe_fd = -1;
 }
 
 void usage()
@@ -327,8 +379,14 @@ Run COMMAND with restrictions.\n\
                            (in form KEY=VALUE;KEY2=VALUE2); may be passed\n\
                            multiple times\n\
   -M, --outmeta=FILE     write metadata (runtime, exitcode, etc.) to FILE\n\
-  -U, --runpipepid=PID   process ID of runpipe to send SIGUSR1 signal when\n\
-                           timelimit is reached\n");
+  -U, --runpipe=SOCKET   socket of runpipe to report timelimits and the\n\
+                           metadata to\n\
+  -R, --reclaim          reclaim the page cache charged to COMMAND before\n\
+                           removing its cgroup, and report how much\n\
+  -Z, --zygote=SOCKET    run COMMAND in a process forked by the zygote\n\
+                           listening on SOCKET if possible, see the source\n\
+  -N, --namespaces=DIR   join the network and UTS namespaces pinned in DIR\n\
+                           instead of creating new ones\n");
 	printf("\
   -v, --verbose          display some extra warnings and information\n\
   -q, --quiet            suppress all warnings and verbose output\n\
@@ -362,14 +420,19 @@ void output_exit_time(int exitcode, double cpudiff)
 	unsigned long ticks_per_second = sysconf(_SC_CLK_TCK);
 	double userdiff = (double)(endticks.tms_cutime - startticks.tms_cutime) / ticks_per_second;
 	double sysdiff  = (double)(endticks.tms_cstime - startticks.tms_cstime) / ticks_per_second;
+	/* A process of the zygote is not our child, so not in times(). */
+	if ( zygote_fd>=0 ) {
+		userdiff = zygote_usertime;
+		sysdiff  = zygote_systime;
+	}
 
 	write_meta("wall-time","{:.3f}", walldiff);
 	write_meta("user-time","{:.3f}", userdiff);
 	write_meta("sys-time", "{:.3f}", sysdiff);
 	write_meta("cpu-time", "{:.3f}", cpudiff);
 
-	logmsg(LOG_DEBUG, "runtime is {:.3f} seconds real, {:.3f} user, {:.3f} sys",
-	        walldiff, userdiff, sysdiff);
+	logmsg_kv(LOG_DEBUG, "runtime in seconds", "real", std::format("{:.3f}", walldiff),
+	          "user", std::format("{:.3f}", userdiff), "sys", std::format("{:.3f}", sysdiff));
 
 	if ( use_walltime && walldiff > walltimelimit[0] ) {
 		walllimit_reached |= soft_timelimit;
@@ -449,142 +512,129 @@ std::set<unsigned> read_cpuset(const char *path)
 
 void check_remaining_procs()
 {
-	char path[1024];
-	snprintf(path, 1023, "/sys/fs/cgroup/%s/cgroup.procs", cgroupname);
-
-	FILE *file = fopen(path, "r");
-	if (file == nullptr) {
-		die(errno, "opening cgroups file `{}'", path);
-	}
-
-	fseek(file, 0L, SEEK_END);
-	if (ftell(file) > 0) {
+	int ret = cg.has_processes();
+	if ( ret<0 ) die(errno, "reading cgroup.procs of cgroup `{}'", cgroupname);
+	if ( ret>0 ) {
 		die(0, "found left-over processes in cgroup controller, please check!");
 	}
-	if (fclose(file) != 0) die(errno, "closing file `{}'", path);
 }
 
 
 void output_cgroup_stats(double *cputime)
 {
-	struct cgroup *cg;
-	if ( (cg = cgroup_new_cgroup(cgroupname))==nullptr ) die(0,"cgroup_new_cgroup");
-
-	int ret;
-	if ((ret = cgroup_get_cgroup(cg)) != 0) die(ret,"get cgroup information");
-
-	struct cgroup_controller *cg_controller = cgroup_get_controller(cg, "memory");
-	int64_t max_usage = 0;
-	ret = cgroup_get_value_int64(cg_controller, "memory.peak", &max_usage);
-	if ( ret == ECGROUPVALUENOTEXIST ) {
-		die(ret, "kernel too old and does not support memory.peak");
-	} else if ( ret!=0 ) {
-		die(ret,"get cgroup value memory.peak");
+	int64_t max_usage = cg.memory_peak();
+	if ( max_usage<0 && errno==ENOENT ) {
+		die(errno, "kernel too old and does not support memory.peak");
+	} else if ( max_usage<0 ) {
+		die(errno,"get cgroup value memory.peak");
 	}
 
 	// There is no need to check swap usage, as we limit it to 0.
 	logmsg(LOG_DEBUG, "total memory used: {} kB", max_usage/1024);
 	write_meta("memory-bytes","{}", max_usage);
 
-	struct cgroup_stat stat;
-	void *handle;
-	ret = cgroup_read_stats_begin("cpu", cgroupname, &handle, &stat);
-	while (ret == 0) {
-		logmsg(LOG_DEBUG, "cpu.stat: {} = {}", stat.name, stat.value);
-		if (strcmp(stat.name, "usage_usec") == 0) {
-			long long usec = strtoll(stat.value, nullptr, 10);
-			*cputime = usec / 1e6;
-		}
-		ret = cgroup_read_stats_next(&handle, &stat);
+	int64_t usec = cg.cpu_stat("usage_usec");
+	if ( usec<0 ) die(errno,"get cgroup value cpu.stat usage_usec");
+	logmsg(LOG_DEBUG, "cpu.stat: usage_usec = {}", usec);
+	*cputime = usec / 1e6;
+
+	if ( zygote_fd>=0 ) {
+		int64_t user_usec = cg.cpu_stat("user_usec");
+		int64_t system_usec = cg.cpu_stat("system_usec");
+		if ( user_usec<0 || system_usec<0 ) die(errno,"get cgroup value cpu.stat user/system_usec");
+		zygote_usertime = user_usec / 1e6;
+		zygote_systime = system_usec / 1e6;
 	}
-	if ( ret!=ECGEOF ) die(ret,"get cgroup value cpu.stat");
-	cgroup_read_stats_end(&handle);
+}
 
-	cgroup_free(&cg);
+/* Return the page cache charged to our cgroup in bytes, that is the `file'
+ * entry of memory.stat, or -1 if it cannot be read. */
+int64_t cgroup_file_bytes()
+{
+	int64_t res = cg.read_stat("memory.stat", "file");
+	if ( res<0 ) warning(errno, "reading memory.stat of cgroup `{}'", cgroupname);
+
+	return res;
 }
 
-/* Temporary shorthand define for error handling. */
-#define cgroup_add_value(type,name,value) \
-	ret = cgroup_add_value_ ## type(cg_controller, name, value); \
-	if ( ret!=0 ) die(ret,"set cgroup value " #name);
+/* Reclaim the page cache charged to our cgroup, that is the files written
+ * and read by the command, by writing the amount to memory.reclaim. When the
+ * cgroup is deleted, its page cache would otherwise be charged to the parent
+ * and stay around. This replaces evicting all files of a judging from the
+ * cache one by one. Must be called after all processes have been killed. */
+void cgroup_reclaim()
+{
+	int64_t before = cgroup_file_bytes();
+	if ( before<0 ) return;
+
+	/* EAGAIN means that less than the requested amount could be
+	   reclaimed, which we measure below anyway. */
+	if ( before>0 && cg.set("memory.reclaim", (uint64_t)before)!=0 && errno!=EAGAIN ) {
+		if ( errno==ENOENT ) {
+			warning(errno, "writing memory.reclaim (requires Linux 5.19 or newer)");
+		} else {
+			warning(errno, "writing memory.reclaim of cgroup `{}'", cgroupname);
+		}
+		return;
+	}
+
+	int64_t after = cgroup_file_bytes();
+	if ( after<0 ) return;
+
+	logmsg(LOG_DEBUG, "reclaimed {} of {} kB page cache", (before - after)/1024, before/1024);
+	write_meta("cache-reclaimed-bytes","{}", before - after);
+}
 
 void cgroup_create()
 {
-	struct cgroup *cg;
-	cg = cgroup_new_cgroup(cgroupname);
-	if (!cg) die(0,"cgroup_new_cgroup");
+	bool use_cpuset = ( cpuset!=nullptr && strlen(cpuset)>0 );
 
-	/* Set up the memory restrictions; these two options limit ram use
-	   and ram+swap use. They are the same so no swapping can occur */
-	struct cgroup_controller *cg_controller;
-	if ( (cg_controller = cgroup_add_controller(cg, "memory"))==nullptr ) {
-		die(0,"cgroup_add_controller memory");
+	/* Create the cgroup with the memory and optionally the cpuset
+	   controller enabled, and keep it open for the rest of the run. */
+	int ret;
+	if ( use_cpuset ) {
+		ret = cg.create(cgroupname, { "memory", "cpuset" });
+	} else {
+		ret = cg.create(cgroupname, { "memory" });
 	}
+	if ( ret!=0 ) die(errno,"creating cgroup `{}'",cgroupname);
 
-	int ret;
+	/* Set up the memory restrictions; these two options limit ram use
+	   and ram+swap use. They are the same so no swapping can occur */
 	// TODO: do we want to set cpu.weight here as well?
 	if (memsize != RLIM_INFINITY) {
-		cgroup_add_value(uint64, "memory.max", memsize);
-		cgroup_add_value(uint64, "memory.swap.max", 0);
+		if ( cg.set("memory.max", (uint64_t)memsize)!=0 ) die(errno,"set cgroup value memory.max");
+		if ( cg.set("memory.swap.max", (uint64_t)0)!=0 ) die(errno,"set cgroup value memory.swap.max");
 	} else {
-		cgroup_add_value(string, "memory.max", "max");
-		cgroup_add_value(string, "memory.swap.max", "max");
+		if ( cg.set("memory.max", "max")!=0 ) die(errno,"set cgroup value memory.max");
+		if ( cg.set("memory.swap.max", "max")!=0 ) die(errno,"set cgroup value memory.swap.max");
 	}
 
 	/* Set up cpu restrictions; we pin the task to a specific set of
 	   cpus. We also give it exclusive access to those cores, and set
 	   no limits on memory nodes */
-	if ( cpuset!=nullptr && strlen(cpuset)>0 ) {
-		if ( (cg_controller = cgroup_add_controller(cg, "cpuset"))==nullptr ) {
-			die(0,"cgroup_add_controller cpuset");
-		}
+	if ( use_cpuset ) {
 		/* To make a cpuset exclusive, some additional setup outside of domjudge is
 		   required, so for now, we will leave this commented out. */
-		/* cgroup_add_value_int64(cg_controller, "cpuset.cpu_exclusive", 1); */
-		cgroup_add_value(string, "cpuset.mems", "0");
-		cgroup_add_value(string, "cpuset.cpus", cpuset);
+		/* cg.set("cpuset.cpu_exclusive", 1); */
+		if ( cg.set("cpuset.mems", "0")!=0 ) die(errno,"set cgroup value cpuset.mems");
+		if ( cg.set("cpuset.cpus", cpuset)!=0 ) die(errno,"set cgroup value cpuset.cpus");
 	} else {
 		logmsg(LOG_DEBUG, "cpuset undefined");
 	}
 
-	/* Perform the actual creation of the cgroup */
-	if ( (ret = cgroup_create_cgroup(cg, 1))!=0 ) die(ret,"creating cgroup");
-
-	cgroup_free(&cg);
 	logmsg(LOG_DEBUG, "created cgroup `{}'",cgroupname);
 }
 
-#undef cgroup_add_value
-
 
 void cgroup_kill()
 {
 	/* kill any remaining tasks, and wait for them to be gone */
-	char mem_controller[10] = "memory";
-	int size;
-	do {
-		pid_t* pids;
-		int ret = cgroup_get_procs(cgroupname, mem_controller, &pids, &size);
-		if(ret != 0) die(ret, "cgroup_get_procs");
-		for(int i = 0; i < size; i++) {
-			kill(pids[i], SIGKILL);
-		}
-		free(pids);
-	} while (size > 0);
+	if ( cg.kill()!=0 ) die(errno, "killing processes in cgroup `{}'", cgroupname);
 }
 
 void cgroup_delete()
 {
-	struct cgroup *cg;
-	cg = cgroup_new_cgroup(cgroupname);
-	if (!cg) die(0,"cgroup_new_cgroup");
-
-	if (cgroup_add_controller(cg, "cpu") == nullptr) die(0, "cgroup_add_controller cpu");
-	if ( cgroup_add_controller(cg, "memory")==nullptr ) die(0,"cgroup_add_controller memory");
-
-	if ( cpuset!=nullptr && strlen(cpuset)>0 ) {
-		if ( cgroup_add_controller(cg, "cpuset")==nullptr ) die(0,"cgroup_add_controller cpuset");
-	}
 	/* Clean up our cgroup. Try immediately; if the kernel hasn't
 	   finished cleaning up yet, retry with short sleeps. */
 	const struct timespec retry_delay = { 0, 1000000L }; /* 1ms */
@@ -592,15 +642,13 @@ void cgroup_delete()
 	int ret;
 	for (int attempt = 0; attempt <= max_retries; attempt++) {
 		if (attempt > 0) nanosleep(&retry_delay, nullptr);
-		ret = cgroup_delete_cgroup_ext(cg, CGFLAG_DELETE_IGNORE_MIGRATION | CGFLAG_DELETE_RECURSIVE);
-		if (ret == 0 || ret == ECGOTHER) break;
+		ret = cg.remove();
+		if (ret == 0 || errno != EBUSY) break;
 		if (attempt < max_retries) {
-			logmsg(LOG_DEBUG, "cgroup delete attempt {} failed ({}), retrying...", attempt + 1, ret);
+			logmsg(LOG_DEBUG, "cgroup delete attempt {} failed ({}), retrying...", attempt + 1, strerror(errno));
 		}
 	}
-	if ( ret!=0 && ret!=ECGOTHER ) die(ret,"deleting cgroup");
-
-	cgroup_free(&cg);
+	if ( ret!=0 ) die(errno,"deleting cgroup `{}'",cgroupname);
 
 	logmsg(LOG_DEBUG, "deleted cgroup `{}'",cgroupname);
 }
@@ -623,9 +671,10 @@ void terminate(int sig)
 	}
 
 	if ( sig==SIGALRM ) {
-		if (runpipe_pid > 0) {
-			warning_from_signalhandler("sending SIGUSR1 to runpipe");
-			kill(runpipe_pid, SIGUSR1);
+		if ( runpipe_fd>=0 ) {
+			static const char msg[] = "time-result: hard-timelimit\n";
+			warning_from_signalhandler("notifying runpipe of timelimit");
+			[[maybe_unused]] auto r = send(runpipe_fd, msg, sizeof(msg)-1, MSG_DONTWAIT);
 		}
 
 		walllimit_reached |= hard_timelimit;
@@ -737,6 +786,248 @@ void read_optarg_time(const char *desc, double *times)
 	free(optcopy);
 }
 
+/* Connect to the socket of runpipe, which we notify as soon as the
+   timelimit is reached and send the metadata to when done. Failure is
+   not fatal: runpipe then only cannot tell a timelimit apart from a
+   regular exit. */
+void connect_runpipe(const char *path)
+{
+	struct sockaddr_un addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	if ( strlen(path)>=sizeof(addr.sun_path) ) {
+		warning(0, "runpipe socket path too long: `{}'", path);
+		return;
+	}
+	strcpy(addr.sun_path, path);
+
+	runpipe_fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+	if ( runpipe_fd<0 ) {
+		warning(errno, "creating runpipe socket");
+		return;
+	}
+	if ( connect(runpipe_fd, (struct sockaddr *)&addr, sizeof(addr))!=0 ) {
+		warning(errno, "connecting to runpipe socket `{}'", path);
+		close(runpipe_fd);
+		runpipe_fd = -1;
+	}
+}
+
+/* Return the parent PID and real user ID of process 'pid', or -1 on error. */
+pid_t parent_of(pid_t pid, uid_t *uid)
+{
+	char path[64], buf[512];
+	snprintf(path, sizeof(path), "/proc/%d/status", (int)pid);
+	FILE *fp = fopen(path, "r");
+	if ( fp==nullptr ) return -1;
+
+	pid_t ppid = -1;
+	*uid = (uid_t)-1;
+	while ( fgets(buf, sizeof(buf), fp)!=nullptr ) {
+		int value;
+		if ( sscanf(buf, "PPid: %d", &value)==1 ) ppid = value;
+		if ( sscanf(buf, "Uid: %d", &value)==1 ) *uid = value;
+	}
+	fclose(fp);
+
+	return ppid;
+}
+
+/* Request a process for the command from the zygote listening on socket
+   'path', see the description at the top. On success, sets child_pid and
+   zygote_fd; the process then waits for zygote_release(). Failure is not
+   fatal: we then execute the command ourselves, as without zygote. */
+void zygote_fork(const char *path)
+{
+	struct timeval before, after;
+	if ( gettimeofday(&before,nullptr) ) die(errno,"getting time");
+
+	struct sockaddr_un addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	if ( strlen(path)>=sizeof(addr.sun_path) ) {
+		warning(0, "zygote socket path too long: `{}'", path);
+		zygote_failed = true;
+		return;
+	}
+	strcpy(addr.sun_path, path);
+
+	int fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+	if ( fd<0 ) die(errno, "creating zygote socket");
+	if ( connect(fd, (struct sockaddr *)&addr, sizeof(addr))!=0 ) {
+		warning(errno, "connecting to zygote `{}', executing command directly", path);
+		close(fd);
+		zygote_failed = true;
+		return;
+	}
+	if ( setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &zygote_timeout, sizeof(zygote_timeout))!=0 ||
+	     setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &zygote_timeout, sizeof(zygote_timeout))!=0 ) {
+		die(errno, "setting timeout on zygote socket");
+	}
+
+	struct ucred cred;
+	socklen_t credlen = sizeof(cred);
+	if ( getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &credlen)!=0 ) {
+		die(errno, "getting credentials of zygote");
+	}
+	if ( use_user && cred.uid!=(uid_t)runuid ) {
+		warning(0, "zygote `{}' runs as user ID {} instead of {}, executing command directly",
+		        path, cred.uid, runuid);
+		close(fd);
+		zygote_failed = true;
+		return;
+	}
+
+	std::string request = "run";
+	request += '\0';
+	request += use_cputime ? std::to_string((long)ceil(cputimelimit[1])) : "0";
+	for(char **arg = cmdargs; *arg!=nullptr; arg++) {
+		request += '\0';
+		request += *arg;
+	}
+
+	int fds[3] = { STDIN_FILENO, child_pipefd[1][PIPE_IN], child_pipefd[2][PIPE_IN] };
+	char control[CMSG_SPACE(sizeof(fds))];
+	memset(control, 0, sizeof(control));
+	struct iovec iov = { request.data(), request.size() };
+	struct msghdr msg;
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control;
+	msg.msg_controllen = sizeof(control);
+	struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_RIGHTS;
+	cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+	memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+
+	char reply[64];
+	ssize_t len;
+	int pid;
+	double startup;
+	if ( sendmsg(fd, &msg, MSG_NOSIGNAL)<0 ||
+	     (len = recv(fd, reply, sizeof(reply)-1, 0))<=0 ) {
+		warning(errno, "requesting process from zygote `{}', executing command directly", path);
+		close(fd);
+		zygote_failed = true;
+		return;
+	}
+	reply[len] = 0;
+
+	/* Make sure that it is not some other process that we are going to
+	   put in our cgroup and kill. */
+	uid_t uid;
+	if ( sscanf(reply, "%d %lf", &pid, &startup)!=2 || pid<=0 ||
+	     parent_of(pid, &uid)!=cred.pid || uid!=cred.uid ) {
+		warning(0, "invalid reply from zygote `{}': `{}', executing command directly", path, reply);
+		close(fd);
+		zygote_failed = true;
+		return;
+	}
+
+	if ( gettimeofday(&after,nullptr) ) die(errno,"getting time");
+	zygote_forktime = (after.tv_sec  - before.tv_sec ) +
+	                  (after.tv_usec - before.tv_usec)*1E-6;
+	zygote_startup = startup;
+	zygote_fd = fd;
+	child_pid = pid;
+	logmsg(LOG_DEBUG, "zygote forked pid {} in {:.3f}s, its startup took {:.3f}s",
+	       pid, zygote_forktime, startup);
+}
+
+/* Put the process of the zygote in our cgroup and let it run. */
+void zygote_release()
+{
+	if ( cg.add_process(child_pid)!=0 ) {
+		die(errno, "Failed to move the process to the cgroup");
+	}
+	if ( send(zygote_fd, "go", 2, MSG_NOSIGNAL)!=2 ) {
+		/* Detected in zygote_wait() below. */
+		warning(errno, "starting process of zygote");
+	}
+}
+
+/* Read the exit status of the process of the zygote into 'status'. The
+   command can kill or stop the zygote, as it runs as the same user: when
+   there is no reply within zygote_timeout, we kill the command too and
+   report that. */
+void zygote_wait(int *status)
+{
+	char reply[32];
+	ssize_t len = recv(zygote_fd, reply, sizeof(reply)-1, 0);
+	if ( len>0 ) {
+		reply[len] = 0;
+		if ( sscanf(reply, "%d", status)==1 ) return;
+	}
+
+	warning(len<0 ? errno : 0, "lost connection to zygote, killing command");
+	cgroup_kill();
+	zygote_failed = true;
+	*status = SIGKILL;
+}
+
+/* Join the network and UTS namespaces pinned in directory 'dir'. Creating
+   a network namespace takes much longer than joining one, and cleaning it
+   up afterwards serializes on a global lock in the kernel, which adds up
+   with many concurrent runs. Returns the CLONE_NEW* flags of the joined
+   namespaces; the others are created as usual. The IPC namespace is not
+   reused, as System V IPC objects and POSIX message queues outlive the
+   processes that created them. */
+int join_namespaces(const char *dir)
+{
+	const struct { const char *name; int type; } pinned[] = {
+		{ "net", CLONE_NEWNET },
+		{ "uts", CLONE_NEWUTS },
+	};
+	int joined = 0;
+
+	int dirfd = open(dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if ( dirfd<0 ) {
+		warning(errno, "opening namespace directory `{}', creating new namespaces", dir);
+		return 0;
+	}
+
+	for(const auto& ns : pinned) {
+		std::string ownpath = std::format("/proc/self/ns/{}", ns.name);
+		struct stat own, st;
+		if ( stat(ownpath.c_str(), &own)!=0 ) die(errno, "cannot stat `{}'", ownpath);
+
+		int fd = openat(dirfd, ns.name, O_RDONLY | O_CLOEXEC);
+		if ( fd<0 || fstat(fd, &st)!=0 ) {
+			warning(errno, "opening pinned {} namespace in `{}', creating a new one", ns.name, dir);
+		} else if ( st.st_dev==own.st_dev && st.st_ino==own.st_ino ) {
+			/* That would be the namespace of the host. */
+			warning(0, "pinned {} namespace in `{}' is our own, creating a new one", ns.name, dir);
+		} else if ( setns(fd, ns.type)!=0 ) {
+			warning(errno, "joining pinned {} namespace in `{}', creating a new one", ns.name, dir);
+		} else {
+			joined |= ns.type;
+		}
+		if ( fd>=0 ) close(fd);
+	}
+	close(dirfd);
+
+	/* The network namespace must not give access to anything else than
+	   the loopback interface, which is what a new one would have. */
+	if ( joined & CLONE_NEWNET ) {
+		FILE *fp = fopen("/proc/self/net/dev", "r");
+		if ( fp==nullptr ) die(errno, "cannot open `/proc/self/net/dev'");
+		char line[512], name[64];
+		for(int lineno=1; fgets(line, sizeof(line), fp)!=nullptr; lineno++) {
+			/* The first two lines are headers. */
+			if ( lineno>2 && sscanf(line, " %63[^:]:", name)==1 && strcmp(name, "lo")!=0 ) {
+				die(0, "pinned net namespace in `{}' has network interface `{}'", dir, name);
+			}
+		}
+		fclose(fp);
+	}
+
+	logmsg(LOG_DEBUG, "joined pinned namespaces in `{}': net {}, uts {}", dir,
+	       (joined & CLONE_NEWNET)!=0, (joined & CLONE_NEWUTS)!=0);
+	return joined;
+}
+
 void setrestrictions()
 {
 	/* Clear environment to prevent all kinds of security holes, save PATH */
@@ -819,9 +1110,8 @@ void setrestrictions()
 	}
 
 	/* Put the child process in the cgroup */
-	const char *controllers[] = { "memory", nullptr };
-	if (cgroup_change_cgroup_path(cgroupname, getpid(), controllers) != 0) {
-		die(0, "Failed to move the process to the cgroup");
+	if ( cg.add_process(getpid())!=0 ) {
+		die(errno, "Failed to move the process to the cgroup");
 	}
 
 	/* Run the command in a separate process group so that the command
@@ -990,6 +1280,7 @@ int main(int argc, char **argv)
 
 	/* Parse command-line options */
 	use_root = use_walltime = use_cputime = use_user = no_coredump = false;
+	reclaim_cache = false;
 	outputmeta = false;
 	walllimit_reached = cpulimit_reached = 0;
 	outputtimetype = CPU_TIME_TYPE;
@@ -999,7 +1290,7 @@ int main(int argc, char **argv)
 	show_help = show_version = 0;
 	opterr = 0;
 	char *ptr;
-	while ( (opt = getopt_long(argc,argv,"+r:u:g:d:t:C:m:f:p:P:co:e:s:EV:M:vqU:",long_opts,nullptr))!=-1 ) {
+	while ( (opt = getopt_long(argc,argv,"+r:u:g:d:t:C:m:f:p:P:co:e:s:EV:M:vqU:RZ:N:",long_opts,nullptr))!=-1 ) {
 		switch ( opt ) {
 		case 0:   /* long-only option */
 			break;
@@ -1077,6 +1368,9 @@ int main(int argc, char **argv)
 		case 'c': /* no-core option */
 			no_coredump = true;
 			break;
+		case 'R': /* reclaim option */
+			reclaim_cache = true;
+			break;
 		case 'o': /* stdout option */
 			redir_stdout = true;
 			stdoutfilename = strdup(optarg);
@@ -1111,8 +1405,14 @@ int main(int argc, char **argv)
 		case 'q': /* quiet option */
 			verbose = LOG_ERR;
 			break;
-		case 'U':
-			runpipe_pid = strtol(optarg, &ptr, 10);
+		case 'U': /* runpipe option */
+			connect_runpipe(optarg);
+			break;
+		case 'Z': /* zygote option */
+			zygotepath = optarg;
+			break;
+		case 'N': /* namespaces option */
+			namespacedir = optarg;
 			break;
 		case ':': /* getopt error */
 		case '?':
@@ -1202,11 +1502,6 @@ int main(int argc, char **argv)
 		}
 	}
 
-	/* Make libcgroup ready for use */
-	ret = cgroup_init();
-	if ( ret!=0 ) {
-		die(0,"libcgroup initialization failed: {}({})\n", cgroup_strerror(ret), ret);
-	}
 	/* Define the cgroup name that we will use and make sure it will
 	 * be unique. Note: group names must have slashes!
 	 */
@@ -1220,7 +1515,9 @@ int main(int argc, char **argv)
 
 	cgroup_create();
 
-	if ( unshare(CLONE_FILES|CLONE_FS|CLONE_NEWIPC|CLONE_NEWNET|CLONE_NEWNS|CLONE_NEWUTS|CLONE_SYSVSEM)!=0 ) {
+	int unshare_flags = CLONE_FILES|CLONE_FS|CLONE_NEWIPC|CLONE_NEWNET|CLONE_NEWNS|CLONE_NEWUTS|CLONE_SYSVSEM;
+	if ( namespacedir!=nullptr ) unshare_flags &= ~join_namespaces(namespacedir);
+	if ( unshare(unshare_flags)!=0 ) {
 		die(errno, "calling unshare");
 	}
 
@@ -1244,7 +1541,10 @@ int main(int argc, char **argv)
 		if ( fclose(fp)!=0 ) die(errno, "closing file `{}'", oom_score_path);
 	}
 
-	switch ( child_pid = fork() ) {
+	if ( zygotepath!=nullptr ) zygote_fork(zygotepath);
+	if ( zygote_fd<0 ) child_pid = fork();
+
+	switch ( child_pid ) {
 	case -1: /* error */
 		die(errno,"cannot fork");
 	case  0: /* run controlled command */
@@ -1278,6 +1578,9 @@ int main(int argc, char **argv)
 		die(errno,"cannot start `{}' as user `{}'", cmdname, getuid());
 
 	default: /* become watchdog */
+		/* No more forks from here on, so let messages from the
+		 * watchdog loop be written in the background. */
+		log_async_start();
 		logmsg(LOG_DEBUG, "child pid = {}", child_pid);
 		/* Shed privileges, only if not using a separate child uid,
 		   because in that case we may need root privileges to kill
@@ -1288,6 +1591,9 @@ int main(int argc, char **argv)
 			logmsg(LOG_DEBUG, "watchdog using user ID `{}'",getuid());
 		}
 
+		/* The time of a process of the zygote starts only now. */
+		if ( zygote_fd>=0 ) zygote_release();
+
 		if ( gettimeofday(&starttime,nullptr) ) die(errno,"getting time");
 
 		/* Close unused file descriptors */
@@ -1366,6 +1672,7 @@ int main(int argc, char **argv)
 		   using read()/write(). */
 		use_splice = true;
 		fd_set readfds;
+		bool killed_cgroup = false;
 		while ( 1 ) {
 
 			FD_ZERO(&readfds);
@@ -1376,6 +1683,10 @@ int main(int argc, char **argv)
 					nfds = std::max(nfds, child_pipefd[i][PIPE_OUT]);
 				}
 			}
+			if ( zygote_fd>=0 ) {
+				FD_SET(zygote_fd,&readfds);
+				nfds = std::max(nfds, zygote_fd);
+			}
 
 			int r = pselect(nfds+1, &readfds, nullptr, nullptr, nullptr, &emptymask);
 			if ( r==-1 && errno!=EINTR ) die(errno,"waiting for child data");
@@ -1383,7 +1694,21 @@ int main(int argc, char **argv)
 				die(errno, "error in signal handler, exiting");
 			}
 
-			if ( received_SIGCHLD || received_signal == SIGALRM ) {
+			/* After a hard time limit or SIGTERM, also kill processes
+			   that left the process group of the command. The process
+			   of a zygote is not our child, so we do not get SIGCHLD for
+			   it, and the zygote may not report its status anymore. */
+			if ( received_signal!=-1 && !killed_cgroup ) {
+				cgroup_kill();
+				killed_cgroup = true;
+			}
+
+			if ( zygote_fd>=0 ) {
+				if ( received_signal!=-1 || (r>0 && FD_ISSET(zygote_fd,&readfds)) ) {
+					zygote_wait(&status);
+					break;
+				}
+			} else if ( received_SIGCHLD || received_signal == SIGALRM ) {
 				pid_t pid;
 				if ( (pid = wait(&status))<0 ) die(errno,"waiting on child");
 				if ( pid==child_pid ) break;
@@ -1467,6 +1792,7 @@ int main(int argc, char **argv)
 		double cputime = -1;
 		output_cgroup_stats(&cputime);
 		cgroup_kill();
+		if ( reclaim_cache ) cgroup_reclaim();
 		cgroup_delete();
 
 		/* Drop root before writing to output file(s). */
@@ -1488,10 +1814,18 @@ int main(int argc, char **argv)
 			write_meta("output-truncated","{}",str);
 		}
 
+		if ( zygote_fd>=0 ) {
+			write_meta("zygote-startup-saved","{:.3f}",
+			           std::max(0.0, zygote_startup - zygote_forktime));
+		}
+		if ( zygote_failed ) write_meta("zygote-failed","1");
+
 		write_meta("stdin-bytes", "{}",data_read[0]);
 		write_meta("stdout-bytes","{}",data_read[1]);
 		write_meta("stderr-bytes","{}",data_read[2]);
 
+		notify_runpipe();
+
 		if ( outputmeta && fclose(metafile)!=0 ) {
 			die(errno,"closing file `{}'",metafilename);
 		}
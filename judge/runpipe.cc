@@ -35,12 +35,37 @@
 // (a) communication between the processes
 // (b) exit of a process
 //
-// Unfortunately, epoll doesn't support waiting for a process exit, but we can
-// emulate it by sending a message in the SIGCHLD signal handler using an extra
-// pipe.
+// Process exits are observed through a pidfd per child (requires Linux 5.3),
+// which becomes readable when the child terminates. This avoids a SIGCHLD
+// handler and the races of coalesced signals.
 //
-// Additionally, we set up a signal handler for SIGUSR1 which runguard will use
-// to indicate when it killed its child process due to a time limit.
+// Additionally, we bind a datagram socket to which runguard (passed to it with
+// `-U`) reports the status of the submission. It sends a message as soon as it
+// killed its child process due to a time limit, and its final resource usage
+// and limit status when it exits. Messages consist of `key: value` lines in
+// the same format as the runguard meta file.
+//
+// Optionally, runpipe enforces a wall clock limit on the second process by
+// itself using a timerfd, so that simple setups do not need a wrapper.
+//
+// Multi-pass problems can keep the first process (the interactor) running
+// across passes: to request another pass, it appends a line to the file
+// `nextpass.resident` in its feedback directory before sending its last
+// message of the current pass. Pass N is run if the file has at least N-1
+// lines. When the second process then exits
+// successfully, it is spawned again and connected to the same interactor.
+// Input that the old process did not consume is passed on to the new one.
+// This requires the proxy, which is then always enabled.
+// The meta file lists the statistics and the status reported by runguard
+// of every pass.
+//
+// With `-I` the first process is not a process at all: the first command is
+// a shared object implementing the C ABI of runpipe_interactor.h, which is
+// loaded and run in a thread of runpipe. It talks to the second process
+// through callbacks that read and write the pipes directly, and write the
+// transcript if enabled. Its exit is signalled through an eventfd, which
+// takes the place of the pidfd of #0. This avoids the context switches to
+// and from a separate interactor process for every message.
 //
 // If the proxy is not enabled (i.e. no traffic capturing), the pipes are set up
 // like this:
@@ -48,8 +73,10 @@
 //   #0            #1
 // stdout -----> stdin
 // stdin  <----- stdout
-// SIGCHLD -----------------> epoll
-// SIGUSR1 -----------------> epoll
+// pidfd #0 ----------------> epoll
+// pidfd #1 ----------------> epoll
+// runguard socket ---------> epoll
+// timerfd -----------------> epoll
 //
 //
 // If the proxy is enabled the pipes are set up like this:
@@ -57,26 +84,42 @@
 //   #0            proxy           #1
 // stdout  ----->  epoll  -----> stdin
 // stdin   <-----  epoll  <----- stdout
-// SIGCHLD ----------^
-// SIGUSR1 ----------^
+// pidfd #0 ---------^
+// pidfd #1 ---------^
+// runguard socket --^
+// timerfd ----------^
 
 #include "config.h"
 
 #include "lib.error.hpp"
 #include "lib.misc.h"
+#include "runpipe_interactor.h"
 
 #include <algorithm>
 #include <array>
+#include <atomic>
 #include <chrono>
+#include <climits>
+#include <cmath>
 #include <csignal>
 #include <cstring>
+#include <dlfcn.h>
 #include <fcntl.h>
 #include <fstream>
 #include <getopt.h>
+#include <map>
 #include <sstream>
 #include <string>
 #include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/timerfd.h>
+#include <sys/uio.h>
+#include <sys/un.h>
 #include <sys/wait.h>
+#include <thread>
 #include <tuple>
 #include <unistd.h>
 #include <vector>
@@ -179,11 +222,31 @@ struct process_t {
   // When the process has been spawned, this contains the pid of the child
   // process.
   pid_t pid = -1;
+  // A pidfd referring to the child process, it becomes readable when the
+  // process exits. It is closed once the process has been waited for.
+  fd_t pidfd = -1;
+
+  // In multi-pass mode we keep the read end of the stdin pipe of the second
+  // process, so that input it did not consume can be passed to the next pass.
+  bool keep_stdin = false;
+  fd_t kept_stdin_fd = -1;
+
+  // Whether this is runguard run through sudo, so that pid refers to sudo.
+  bool via_runguard = false;
 
   bool exited = false;
   // Information about the exited process. Meaningful only if exited == true.
   int exitInfo = -1;
 
+  // Resource usage of the process including its waited-for descendants, as
+  // reported by wait4(). In multi-pass mode times are summed and memory is
+  // the maximum over all runs.
+  chrono::steady_clock::time_point start_time;
+  chrono::steady_clock::duration wall_time{};
+  double user_time = 0;
+  double sys_time = 0;
+  long max_rss_kib = 0;
+
   process_t(size_t index) : index(index) {}
 
   string debug() const {
@@ -231,18 +294,23 @@ struct process_t {
     return WEXITSTATUS(exitInfo);
   }
 
-  // Fork and exec the child process, redirecting its standard I/O.
-  void spawn() {
+  // Fork and exec the child process, redirecting its standard I/O. If the
+  // process is runguard, it is told to notify us on the given socket when it
+  // hits the time limit.
+  void spawn(const string &status_socket) {
     std::array<int, 3> stdio = {stdin_fd, stdout_fd, FDREDIR_NONE};
 
     auto exec_args = args;
     if (cmd == "sudo" && exec_args.size() > 1 && exec_args[1].find("/runguard") != string::npos) {
         // This is a hack, and can be improved significantly after implementing
         // https://docs.google.com/document/d/1WZRwdvJUamsczYC7CpP3ZIBU8xG6wNqYqrNJf7osxYs/edit#heading=h.i7kgdnmw8qd7
-        exec_args.push_back("-U");
-        exec_args.push_back(std::to_string(getpid()));
+        // The option must directly follow the runguard command, since
+        // anything after its command argument is passed to the submission.
+        exec_args.insert(exec_args.begin() + 2, {"-U", status_socket});
+        via_runguard = true;
     }
 
+    start_time = chrono::steady_clock::now();
     pid = execute(cmd, exec_args, stdio, false);
     if (pid < 0) {
       error(errno, "failed to execute command #{}", index);
@@ -250,14 +318,34 @@ struct process_t {
     logmsg(LOG_DEBUG, "started #{}, pid {}", index, pid);
     // Do not leak these file descriptors, otherwise we cannot detect if the
     // process has closed stdout.
-    close(stdin_fd);
+    if (keep_stdin) {
+      kept_stdin_fd = stdin_fd;
+    } else {
+      close(stdin_fd);
+    }
     close(stdout_fd);
+
+    // The child cannot be reaped before we wait for it, so this pidfd always
+    // refers to our child, even if it already exited.
+    pidfd = static_cast<fd_t>(syscall(SYS_pidfd_open, pid, 0));
+    if (pidfd < 0) {
+      error(errno, "failed to open pidfd for #{}", index);
+    }
   }
 
   // Function called when the process exits.
-  void on_exit(int status) {
+  void on_exit(int status, const rusage &usage) {
     exited = true;
     exitInfo = status;
+    wall_time += chrono::steady_clock::now() - start_time;
+    user_time += usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6;
+    sys_time += usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6;
+    max_rss_kib = max(max_rss_kib, usage.ru_maxrss);
+    // Closing the pidfd also removes it from the epoll set.
+    if (pidfd != -1) {
+      close(pidfd);
+      pidfd = -1;
+    }
   }
 
   // Close the file descriptor of the pipe coming into the process
@@ -267,6 +355,7 @@ struct process_t {
       logmsg(LOG_DEBUG, "closing fd: {} (proxy -> process) of {}",
              proxy_to_process, pid);
       close(proxy_to_process);
+      proxy_to_process = -1;
     }
   }
 
@@ -277,6 +366,7 @@ struct process_t {
       logmsg(LOG_DEBUG, "closing fd: {} (process -> proxy) of {}",
              process_to_proxy, pid);
       close(process_to_proxy);
+      process_to_proxy = -1;
     }
   }
 
@@ -288,7 +378,29 @@ struct process_t {
     // coming out of there. This will make sure all the pipes are closed.
     if (exited) {
       close_output_fd();
+      if (kept_stdin_fd != -1) {
+        close(kept_stdin_fd);
+        kept_stdin_fd = -1;
+      }
+    }
+  }
+
+  // Read the input that was sent to the process but not consumed by it. This
+  // must be called only after the process exited and the proxy closed its
+  // input, otherwise the read blocks.
+  string take_unconsumed_input() {
+    string input;
+    if (kept_stdin_fd == -1) {
+      return input;
     }
+    char buffer[4096];
+    ssize_t nread;
+    while ((nread = read(kept_stdin_fd, buffer, sizeof(buffer))) > 0) {
+      input.append(buffer, nread);
+    }
+    close(kept_stdin_fd);
+    kept_stdin_fd = -1;
+    return input;
   }
 };
 
@@ -339,13 +451,10 @@ struct output_file_t {
     }
   }
 
-  // Write all the data into the output file, including the header of this
-  // message. The buffer should be at least long size+1.
-  void write(char *buffer, ssize_t size, const process_t &from) {
-    if (output_file == -1) {
-      return;
-    }
-
+  // Format the header of a message of the given size into the buffer and
+  // return its length.
+  int format_header(char *header, size_t header_size, ssize_t size,
+                    const process_t &from) {
     // The runtime is converted into sec + millis manually instead of with %f
     // because benchmarks showed that it's quite expensive.
     auto duration = chrono::steady_clock::now() - start;
@@ -353,22 +462,67 @@ struct output_file_t {
     int time_sec = time / 1000;
     int time_millis = time % 1000;
 
-    const size_t HEADER_SIZE = 64;
-    char header[HEADER_SIZE];
-
     char direction = from.index == 0 ? '>' : '<';
     int header_len =
-        snprintf(header, HEADER_SIZE, "[%3d.%03ds/%ld]%c: ", time_sec,
+        snprintf(header, header_size, "[%3d.%03ds/%ld]%c: ", time_sec,
                  time_millis, size, direction);
     // Check that snprintf didn't truncate the header.
-    if (header_len >= static_cast<int>(HEADER_SIZE)) {
-      error(0, "header size too small: {} > {}", header_len, HEADER_SIZE);
+    if (header_len >= static_cast<int>(header_size)) {
+      error(0, "header size too small: {} > {}", header_len, header_size);
     }
+    return header_len;
+  }
+
+  // Write all the data into the output file, including the header of this
+  // message. The buffer should be at least long size+1.
+  void write(char *buffer, ssize_t size, const process_t &from) {
+    if (output_file == -1) {
+      return;
+    }
+
+    const size_t HEADER_SIZE = 64;
+    char header[HEADER_SIZE];
+    int header_len = format_header(header, HEADER_SIZE, size, from);
 
     write_all(output_file, header, header_len);
     buffer[size] = '\n'; // avoids another call to write_all just for the \n
     write_all(output_file, buffer, size + 1);
   }
+
+  // Like the above, for a buffer that we may not write to. This is used by
+  // the in-process interactor, which owns the buffers of its messages.
+  void write(const char *buffer, ssize_t size, const process_t &from) {
+    if (output_file == -1) {
+      return;
+    }
+
+    const size_t HEADER_SIZE = 64;
+    char header[HEADER_SIZE];
+    int header_len = format_header(header, HEADER_SIZE, size, from);
+
+    char newline = '\n';
+    iovec iov[3] = {
+        {header, static_cast<size_t>(header_len)},
+        {const_cast<char *>(buffer), static_cast<size_t>(size)},
+        {&newline, 1},
+    };
+    // Short writes to regular files only happen on errors like a full disk.
+    if (writev(output_file, iov, 3) < 0) {
+      warning(errno, "failed to write to proxy output file");
+    }
+  }
+
+  // Write the marker for the end of file of the output of the given process.
+  void write_eof(const process_t &from) {
+    auto duration = chrono::steady_clock::now() - start;
+    auto time = duration.count() / 1000 / 1000; // ns -> ms
+    int time_sec = time / 1000;
+    int time_millis = time % 1000;
+    char direction = from.index == 0 ? ']' : '[';
+    char eofbuf[128];
+    snprintf(eofbuf, sizeof(eofbuf), "[%3d.%03ds/%ld]%c", time_sec, time_millis, 0L, direction);
+    write_all(output_file, eofbuf, strlen(eofbuf));
+  }
 };
 
 void usage() {
@@ -380,6 +534,12 @@ Run two commands with stdin/stdout bi-directionally connected.\n\
   printf("\
   -o, --outprog=FILE   write stdout from second program to FILE\n\
   -M, --outmeta=FILE   write metadata (runtime, exit_code, etc.) of first program to FILE\n\
+  -t, --walltime=TIME  kill the second program after TIME wallclock seconds\n\
+  -F, --feedback=DIR   feedback directory of the first program\n\
+  -p, --passes=N       run the second program up to N times against the same\n\
+                         first program when it requests a next pass in DIR\n\
+  -I, --in-process     load the first program as a shared object implementing\n\
+                         runpipe_interactor.h and run it inside runpipe\n\
   -v, --verbose        display some extra warnings and information\n\
   -h, --help           display this help and exit\n\
       --version        output version information and exit\n\
@@ -398,6 +558,11 @@ struct state_t {
     int show_version = 0;
     string output_file;
     string meta_file;
+    // Hard wall clock limit of the second process in seconds, or 0 if unset.
+    double walltime = 0;
+    string feedback_dir;
+    int max_passes = 1;
+    bool in_process = false;
   } args;
 
   // The two processes to execute.
@@ -408,13 +573,31 @@ struct state_t {
 
   // Child indicated TLE.
   bool child_indicated_timelimit = false;
-
-  // The pipe from which the events about the child exits can be read. The
-  // events are writted by the SIGCHLD handler.
-  fd_t child_exited_pipe = -1;
-  // The pipe from which the events about the child time limits can be read. The
-  // events are writted by the SIGUSR1 handler.
-  fd_t child_timelimit_pipe = -1;
+  // The status of the submission as reported by runguard over the status
+  // socket, or as determined by our own limits.
+  map<string, string> submission_status;
+
+  // The datagram socket on which runguard reports the status of the
+  // submission, and the private directory containing it.
+  fd_t status_socket = -1;
+  string status_socket_dir;
+  string status_socket_path;
+  // The timer enforcing the wall clock limit of the second process.
+  fd_t walltime_timer = -1;
+  // Whether the wall clock limit has been reached and SIGTERM was sent.
+  bool walltime_terminated = false;
+
+  // Statistics of a single run of the second process in multi-pass mode.
+  struct pass_t {
+    int64_t duration_us;
+    size_t bytes_transferred;
+    int exit_code;
+    map<string, string> submission_status;
+  };
+  vector<pass_t> passes;
+  chrono::time_point<chrono::high_resolution_clock> pass_start =
+      chrono::high_resolution_clock::now();
+  size_t pass_bytes_start = 0;
   // The file descriptor of the epoll.
   fd_t epoll_fd = -1;
 
@@ -426,9 +609,24 @@ struct state_t {
   // filled only if the proxy is active.
   size_t total_bytes_transferred = 0;
 
+  // The shared object of the in-process interactor, its entry point and the
+  // thread running it. The exit code is valid once the thread signalled its
+  // exit on the eventfd that is used as pidfd of #0.
+  void *interactor_handle = nullptr;
+  decltype(&runpipe_interactor_main) interactor_main = nullptr;
+  thread interactor_thread;
+  atomic<int> interactor_exit_code{-1};
+  // Resource usage of the interactor thread. Its memory cannot be told apart
+  // from that of runpipe itself.
+  rusage interactor_usage{};
+  // The in-process interactor dies with runpipe, so SIGTERM must not be
+  // ignored after forwarding it.
+  static inline bool sigterm_kills_self = false;
+
   state_t(int argc, char **argv) {
     parse_flags(argc, argv);
     parse_commands(argc, argv);
+    processes[1].keep_stdin = is_multipass();
   }
 
   void parse_flags(int argc, char **argv) {
@@ -439,13 +637,17 @@ struct state_t {
       {"version", no_argument,       &args.show_version, 1  },
       {"outprog", required_argument, nullptr,            'o'},
       {"outmeta", required_argument, nullptr,            'M'},
+      {"walltime", required_argument, nullptr,           't'},
+      {"feedback", required_argument, nullptr,           'F'},
+      {"passes",  required_argument, nullptr,            'p'},
+      {"in-process", no_argument,    nullptr,            'I'},
       { nullptr,  0,                 nullptr,             0 }
     };
     // clang-format on
 
     progname = argv[0];
     int opt = -1;
-    while ((opt = getopt_long(argc, argv, "+o:M:vh", long_opts, nullptr)) != -1) {
+    while ((opt = getopt_long(argc, argv, "+o:M:t:F:p:Ivh", long_opts, nullptr)) != -1) {
       switch (opt) {
       case 0: /* long-only option */
         break;
@@ -462,6 +664,35 @@ struct state_t {
         args.meta_file = optarg;
         logmsg(LOG_DEBUG, "writing metadata to '{}'", args.meta_file);
         break;
+      case 't': { /* walltime option */
+        char *end = nullptr;
+        errno = 0;
+        args.walltime = strtod(optarg, &end);
+        if (errno || *end != '\0' || !isfinite(args.walltime) ||
+            args.walltime <= 0) {
+          error(errno, "invalid walltime specified: `{}'", optarg);
+        }
+        logmsg(LOG_DEBUG, "limiting walltime of second program to {} s",
+               args.walltime);
+        break;
+      }
+      case 'F': /* feedback option */
+        args.feedback_dir = optarg;
+        break;
+      case 'p': { /* passes option */
+        char *end = nullptr;
+        errno = 0;
+        long passes = strtol(optarg, &end, 10);
+        if (errno || *end != '\0' || passes < 1 || passes > INT_MAX) {
+          error(errno, "invalid number of passes specified: `{}'", optarg);
+        }
+        args.max_passes = static_cast<int>(passes);
+        break;
+      }
+      case 'I': /* in-process option */
+        args.in_process = true;
+        sigterm_kills_self = true;
+        break;
       case 'h':
         args.show_help = 1;
         break;
@@ -481,6 +712,13 @@ struct state_t {
       version(PROGRAM, VERSION);
     }
 
+    if (args.max_passes > 1 && args.feedback_dir.empty()) {
+      error(0, "multiple passes require a feedback directory");
+    }
+    if (args.max_passes > 1 && args.in_process) {
+      error(0, "multiple passes are not supported with an in-process interactor");
+    }
+
     if (argc <= optind) {
       logmsg(LOG_ERR, "no command specified");
       exit(1);
@@ -540,7 +778,37 @@ struct state_t {
 
   process_t &main_process() { return processes.front(); }
 
-  bool has_proxy() { return !args.output_file.empty(); }
+  bool is_multipass() { return args.max_passes > 1; }
+
+  // In multi-pass mode the proxy is needed to reconnect the interactor to a
+  // new instance of the second process.
+  // The in-process interactor does the job of the proxy itself.
+  bool has_proxy() {
+    return !args.in_process && (!args.output_file.empty() || is_multipass());
+  }
+
+  string nextpass_file() { return args.feedback_dir + "/nextpass.resident"; }
+
+  // Whether the interactor requested another run of the second process and
+  // is still around to communicate with it. The number of the current pass
+  // is one more than the number of finished passes, unless the process of
+  // the current pass has already been recorded as finished.
+  bool next_pass_requested() {
+    size_t current_pass = passes.size() + (processes[1].exited ? 0 : 1);
+    if (!is_multipass() || current_pass >= static_cast<size_t>(args.max_passes)) {
+      return false;
+    }
+    if (processes[0].exited) {
+      return false;
+    }
+    // Only complete lines count, the interactor may be writing right now.
+    ifstream nextpass(nextpass_file());
+    size_t requested_pass = 1;
+    for (string line; getline(nextpass, line) && !nextpass.eof();) {
+      requested_pass++;
+    }
+    return requested_pass > current_pass;
+  }
 
   // Install a handler for SIGTERM: This will send SIGTERM to all
   // children and then restore the default signal handler.
@@ -564,7 +832,7 @@ struct state_t {
       // When SIGTERM is received, the original handler is restored and then
       // the signal is propagated to the children.
       struct sigaction sigact{};
-      sigact.sa_handler = SIG_IGN;
+      sigact.sa_handler = sigterm_kills_self ? SIG_DFL : SIG_IGN;
       sigact.sa_flags = 0;
       if (sigemptyset(&sigact.sa_mask)) {
         warning(errno, "creating signal mask");
@@ -585,97 +853,166 @@ struct state_t {
     }
   }
 
-  // Install a handler for the given signal. The handler will send a byte to
-  // a pipe notifying the main loop.
-  // This method can be called only once for a given signal.
-  template<int signum>
-  fd_t install_signal_handler() {
-    fd_t fds[2];
-    if (pipe2(fds, O_CLOEXEC | O_NONBLOCK)) {
-      error(errno, "creating exit pipes");
+  // Create the socket on which runguard reports the status of its child. It
+  // lives in a private directory outside of the judging
+  // directory, so the submission cannot reach it.
+  void setup_status_socket() {
+    char dir_template[] = "/tmp/runpipe-XXXXXX";
+    if (mkdtemp(dir_template) == nullptr) {
+      error(errno, "creating directory for status socket");
     }
+    status_socket_dir = dir_template;
+    status_socket_path = status_socket_dir + "/status.sock";
 
-    // The lambda below cannot capture anything, otherwise it couldn't be made
-    // into a function pointer. Therefore the write_end must have a static
-    // lifetime.
-    fd_t read_end = fds[0];
-    static fd_t write_end = -1;
-    if (write_end != -1) {
-      error(0, "attempted to install signal handler for {} twice", signum);
+    sockaddr_un addr{};
+    addr.sun_family = AF_UNIX;
+    if (status_socket_path.size() >= sizeof(addr.sun_path)) {
+      error(0, "status socket path too long: {}", status_socket_path);
+    }
+    strcpy(addr.sun_path, status_socket_path.c_str());
+
+    status_socket =
+        socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+    if (status_socket == -1) {
+      error(errno, "creating status socket");
     }
-    write_end = fds[1];
+    if (bind(status_socket, reinterpret_cast<sockaddr *>(&addr),
+             sizeof(addr))) {
+      error(errno, "binding status socket to {}", status_socket_path);
+    }
+    logmsg(LOG_DEBUG, "listening for runguard status on {} (fd {})",
+           status_socket_path, status_socket);
+  }
+
+  // Remove the status socket and its directory again.
+  void cleanup_status_socket() {
+    if (status_socket_dir.empty()) {
+      return;
+    }
+    close(status_socket);
+    if (unlink(status_socket_path.c_str())) {
+      warning(errno, "failed to remove {}", status_socket_path);
+    }
+    if (rmdir(status_socket_dir.c_str())) {
+      warning(errno, "failed to remove {}", status_socket_dir);
+    }
+    status_socket_dir.clear();
+  }
 
-    logmsg(LOG_DEBUG, "exit handler will send event using {} -> {}", write_end,
-           read_end);
+  // Arm a timer that fires when the second process exceeds its wall clock
+  // limit, if one was set.
+  void setup_walltime_timer() {
+    if (args.walltime <= 0) {
+      return;
+    }
+    walltime_timer = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+    if (walltime_timer == -1) {
+      error(errno, "creating walltime timer");
+    }
+    arm_walltime_timer(args.walltime);
+  }
 
-    signal(signum, [](int) {
-      // Notify the main loop that a signal was received by sending a message
-      // via the pipe. Logging is done in the main loop since syslog is not
-      // async-signal-safe (see `man 7 signal-safety`).
-      static char buf[] = {42};
-      if (write(write_end, buf, 1) != 1) {
-        error(errno, "failed to notify main loop of signal");
+  void arm_walltime_timer(double seconds) {
+    itimerspec spec{};
+    double whole;
+    spec.it_value.tv_sec = static_cast<time_t>(seconds);
+    spec.it_value.tv_nsec = static_cast<long>(modf(seconds, &whole) * 1e9);
+    if (timerfd_settime(walltime_timer, 0, &spec, nullptr)) {
+      error(errno, "setting walltime timer");
+    }
+  }
+
+  // The wall clock limit of the second process expired. First ask it to
+  // terminate, and kill it for good if it is still around after a grace
+  // period. Runguard is only sent SIGTERM, which sudo passes on and on which
+  // it kills its cgroup: SIGKILL would only kill sudo and leave runguard
+  // and the submission running, and a second SIGTERM would kill runguard
+  // before it cleaned up.
+  void handle_walltime_event() {
+    uint64_t expirations;
+    if (read(walltime_timer, &expirations, sizeof(expirations)) < 0) {
+      if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        return;
       }
-    });
+      error(errno, "failed to read from walltime timer");
+    }
+
+    process_t &proc = processes[1];
+    if (proc.exited) {
+      return;
+    }
+    if (!walltime_terminated) {
+      warning(0, "timelimit exceeded (hard wall time): terminating #{}",
+              proc.index);
+      walltime_terminated = true;
+      child_indicated_timelimit = true;
+      submission_status["time-result"] = "hard-timelimit";
+      if (kill(proc.pid, SIGTERM) && errno != ESRCH) {
+        warning(errno, "sending SIGTERM to #{}", proc.index);
+      }
+      if (!proc.via_runguard) {
+        arm_walltime_timer(1.0);
+      }
+    } else {
+      warning(0, "#{} did not terminate, sending SIGKILL", proc.index);
+      if (kill(proc.pid, SIGKILL) && errno != ESRCH) {
+        warning(errno, "sending SIGKILL to #{}", proc.index);
+      }
+    }
+  }
+
+  // Create and set up a pipe.
+  static pair<fd_t, fd_t> make_pipe() {
+    fd_t fds[2];
+    if (pipe2(fds, O_CLOEXEC)) {
+      error(errno, "creating pipes");
+    }
+    fd_t read_end = fds[0];
+    fd_t write_end = fds[1];
+    resize_pipe(read_end);
+    resize_pipe(write_end);
 
-    return read_end;
+    return make_pair(read_end, write_end);
   }
 
-  // Install a handler for the SIGCHLD signal. The handler will send a byte to
-  // a pipe notifying the main loop that a child exited.
-  // This method can be called only once.
-  void install_sigchld_handler() {
-    child_exited_pipe = install_signal_handler<SIGCHLD>();
+  // Create the pipe from the process to the proxy.
+  static void make_proxy_output_pipe(process_t &process) {
+    fd_t read_end = -1, write_end = -1;
+    tie(read_end, write_end) = make_pipe();
+    logmsg(LOG_DEBUG, "setting up pipe #{} (fd {}) -> proxy (fd {})",
+           process.index, write_end, read_end);
+    process.stdout_fd = write_end;
+    process.process_to_proxy = read_end;
+    set_non_blocking(process.process_to_proxy);
   }
 
-  // Install a handler for the SIGUSR1 signal. The handler will send a byte to
-  // a pipe notifying the main loop that the child was terminated due to time
-  // limit. This method can be called only once.
-  void install_sigusr1_handler() {
-    child_timelimit_pipe = install_signal_handler<SIGUSR1>();
+  // Create the pipe from the proxy to the process.
+  static void make_proxy_input_pipe(process_t &process) {
+    fd_t read_end = -1, write_end = -1;
+    tie(read_end, write_end) = make_pipe();
+    logmsg(LOG_DEBUG, "setting up pipe proxy (fd {}) -> #{} (fd {})",
+           write_end, process.index, read_end);
+    process.proxy_to_process = write_end;
+    process.stdin_fd = read_end;
   }
 
   // Create the pipes used for the process communication, including the ones for
   // the proxy, if enabled.
   void setup_pipes() {
-    // Create and set up a pipe.
-    auto make_pipe = [&]() {
-      fd_t fds[2];
-      if (pipe2(fds, O_CLOEXEC)) {
-        error(errno, "creating pipes");
-      }
-      fd_t read_end = fds[0];
-      fd_t write_end = fds[1];
-      resize_pipe(read_end);
-      resize_pipe(write_end);
-
-      return make_pair(read_end, write_end);
-    };
-
     for (size_t i = 0; i < processes.size(); i++) {
       size_t j = 1 - i;
       // Set up the communication #i -> #j (optionally with a proxy in between).
       process_t &process = processes[i];
       process_t &other = processes[j];
 
-      fd_t read_end = -1, write_end = -1;
       if (has_proxy()) {
         // Use two pipes for the given direction with the
         // proxy in between.
-        tie(read_end, write_end) = make_pipe();
-        logmsg(LOG_DEBUG, "setting up pipe #{} (fd {}) -> proxy (fd {})", i,
-               write_end, read_end);
-        process.stdout_fd = write_end;
-        process.process_to_proxy = read_end;
-        set_non_blocking(process.process_to_proxy);
-
-        tie(read_end, write_end) = make_pipe();
-        logmsg(LOG_DEBUG, "setting up pipe proxy (fd {}) -> #{} (fd {})",
-               write_end, j, read_end);
-        other.proxy_to_process = write_end;
-        other.stdin_fd = read_end;
+        make_proxy_output_pipe(process);
+        make_proxy_input_pipe(other);
       } else {
         // No proxy: direct communication.
+        fd_t read_end = -1, write_end = -1;
         tie(read_end, write_end) = make_pipe();
         logmsg(LOG_DEBUG, "setting up pipe #{} (fd {}) -> #{} (fd {})", i,
                write_end, j, read_end);
@@ -686,33 +1023,39 @@ struct state_t {
   }
 
   // Create the epoll and register the file descriptors to it.
+  void add_fd(fd_t fd) {
+    logmsg(LOG_DEBUG, "epoll will listen for fd {}", fd);
+    epoll_event ev{};
+    ev.data.fd = fd;
+    ev.events = EPOLLIN;
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev)) {
+      error(errno, "failed to add fd {} to epoll", fd);
+    }
+  }
+
   void init_epoll() {
     epoll_fd = epoll_create1(0);
     if (epoll_fd == -1) {
       error(errno, "error creating epoll");
     }
 
-    auto add_fd = [&](fd_t fd) {
-      logmsg(LOG_DEBUG, "epoll will listen for fd {}", fd);
-      epoll_event ev{};
-      ev.data.fd = fd;
-      ev.events = EPOLLIN;
-      if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev)) {
-        error(errno, "failed to add fd {} to epoll", fd);
-      }
-    };
-
     // Always listen for child exit events.
-    if (child_exited_pipe == -1) {
-      error(0, "SIGCHLD handler not installed");
+    for (auto &proc : processes) {
+      if (proc.pidfd == -1) {
+        error(0, "process #{} has no pidfd", proc.index);
+      }
+      add_fd(proc.pidfd);
     }
-    add_fd(child_exited_pipe);
 
     // Always listen for child timelimit events.
-    if (child_timelimit_pipe == -1) {
-      error(0, "SIGUSR1 handler not installed");
+    if (status_socket == -1) {
+      error(0, "status socket not set up");
+    }
+    add_fd(status_socket);
+
+    if (walltime_timer != -1) {
+      add_fd(walltime_timer);
     }
-    add_fd(child_timelimit_pipe);
 
     // Listen for incoming data only when proxy is enabled.
     if (has_proxy()) {
@@ -722,60 +1065,277 @@ struct state_t {
     }
   }
 
-  // Wait for an exited child without blocking. If a child has been waited
-  // successfully this method returns true.
-  bool handle_child_exit() {
-    // Consume what the signal handler wrote in this pipe.
-    static char buffer[1];
-    if (read(child_exited_pipe, buffer, 1) != 1) {
-      // This function may be called also if no one wrote in the pipe, so ignore
-      // those errors but still try to wait for a child.
-      if (errno != EAGAIN && errno != EWOULDBLOCK) {
-        error(errno, "failed to read from exit pipe");
+  // Load the shared object of the in-process interactor and set up the
+  // eventfd signalling its exit in place of a pidfd.
+  void load_interactor() {
+    process_t &proc = processes[0];
+    interactor_handle = dlopen(proc.cmd.c_str(), RTLD_NOW | RTLD_LOCAL);
+    if (interactor_handle == nullptr) {
+      error(0, "failed to load interactor {}: {}", proc.cmd, dlerror());
+    }
+    auto abi_version = reinterpret_cast<decltype(&runpipe_interactor_abi_version)>(
+        dlsym(interactor_handle, "runpipe_interactor_abi_version"));
+    interactor_main = reinterpret_cast<decltype(&runpipe_interactor_main)>(
+        dlsym(interactor_handle, "runpipe_interactor_main"));
+    if (abi_version == nullptr || interactor_main == nullptr) {
+      error(0, "interactor {} does not implement the runpipe interactor ABI",
+            proc.cmd);
+    }
+    if (abi_version() != RUNPIPE_INTERACTOR_ABI_VERSION) {
+      error(0, "interactor {} has ABI version {}, expected {}", proc.cmd,
+            abi_version(), RUNPIPE_INTERACTOR_ABI_VERSION);
+    }
+
+    proc.pid = getpid();
+    proc.pidfd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (proc.pidfd == -1) {
+      error(errno, "failed to create eventfd for #{}", proc.index);
+    }
+    logmsg(LOG_DEBUG, "loaded interactor {} in process", proc.cmd);
+  }
+
+  // The context of the callbacks of the in-process interactor.
+  struct interactor_io_t {
+    state_t *state;
+    output_file_t *output_file;
+  };
+
+  static ssize_t interactor_read(void *ctx, void *buf, size_t len) {
+    auto *io = static_cast<interactor_io_t *>(ctx);
+    process_t &self = io->state->processes[0];
+    process_t &other = io->state->processes[1];
+    ssize_t nread;
+    do {
+      nread = read(self.stdin_fd, buf, len);
+    } while (nread < 0 && errno == EINTR);
+    if (nread > 0) {
+      io->output_file->write(static_cast<const char *>(buf), nread, other);
+      io->state->total_bytes_transferred += nread;
+    } else if (nread == 0) {
+      io->output_file->write_eof(other);
+    }
+    return nread;
+  }
+
+  static ssize_t interactor_write(void *ctx, const void *buf, size_t len) {
+    auto *io = static_cast<interactor_io_t *>(ctx);
+    process_t &self = io->state->processes[0];
+    const char *data = static_cast<const char *>(buf);
+    size_t index = 0;
+    while (index < len) {
+      ssize_t nwrite = write(self.stdout_fd, data + index, len - index);
+      if (nwrite < 0) {
+        if (errno == EINTR) {
+          continue;
+        }
+        return -1;
       }
+      index += nwrite;
     }
+    io->output_file->write(data, len, self);
+    io->state->total_bytes_transferred += len;
+    return len;
+  }
 
+  static void interactor_close(void *ctx) {
+    auto *io = static_cast<interactor_io_t *>(ctx);
+    process_t &self = io->state->processes[0];
+    if (self.stdout_fd != -1) {
+      close(self.stdout_fd);
+      self.stdout_fd = -1;
+      io->output_file->write_eof(self);
+    }
+  }
+
+  // Run the in-process interactor in a thread. When it returns, its pipes
+  // are closed, just like they are when an interactor process exits.
+  void start_interactor(output_file_t &output_file) {
+    processes[0].start_time = chrono::steady_clock::now();
+    interactor_thread = thread([this, &output_file]() {
+      process_t &proc = processes[0];
+      vector<char *> argv;
+      argv.push_back(proc.cmd.data());
+      for (auto &arg : proc.args) {
+        argv.push_back(arg.data());
+      }
+      argv.push_back(nullptr);
+
+      interactor_io_t ctx{this, &output_file};
+      runpipe_io io{&ctx, interactor_read, interactor_write, interactor_close};
+      int exit_code = interactor_main(static_cast<int>(argv.size() - 1),
+                                      argv.data(), &io);
+      logmsg(LOG_DEBUG, "in-process interactor returned {}", exit_code);
+
+      interactor_close(&ctx);
+      close(proc.stdin_fd);
+      proc.stdin_fd = -1;
+      interactor_exit_code = exit_code & 0xff;
+      if (getrusage(RUSAGE_THREAD, &interactor_usage)) {
+        warning(errno, "failed to get resource usage of interactor");
+      }
+      uint64_t one = 1;
+      if (::write(proc.pidfd, &one, sizeof(one)) < 0) {
+        error(errno, "failed to signal exit of in-process interactor");
+      }
+    });
+  }
+
+  // Wait for the in-process interactor if it signalled its exit, and
+  // return the pid of runpipe in that case, and 0 otherwise.
+  pid_t wait_interactor(process_t &proc, int *status, rusage *usage) {
+    uint64_t value;
+    if (read(proc.pidfd, &value, sizeof(value)) < 0) {
+      if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        return 0;
+      }
+      error(errno, "failed to read exit of in-process interactor");
+    }
+    interactor_thread.join();
+    *status = W_EXITCODE(interactor_exit_code.load(), 0);
+    *usage = interactor_usage;
+    return proc.pid;
+  }
+
+  // The pidfd of the given process became readable: reap it without
+  // blocking. If the child has been waited successfully this method returns
+  // true.
+  bool handle_child_exit(process_t &proc, output_file_t &output_file) {
     int status = -1;
-    // Check if a child exited without blocking.
-    pid_t pid = waitpid(-1, &status, WNOHANG);
+    rusage usage{};
+    pid_t pid;
+    if (proc.index == 0 && args.in_process) {
+      pid = wait_interactor(proc, &status, &usage);
+    } else {
+      pid = wait4(proc.pid, &status, WNOHANG, &usage);
+    }
     if (pid < 0) {
       error(errno, "failed to wait for child exit");
     }
-    // No child has exited.
+    // The process has not exited yet.
     if (pid == 0) {
       return false;
     }
 
-    logmsg(LOG_DEBUG, "child with pid {} exited", pid);
+    logmsg(LOG_DEBUG, "child #{} with pid {} exited", proc.index, pid);
+
+    // runguard sends its final status right before exiting. Read it now, so
+    // that it is accounted to the pass that just ended.
+    if (proc.index == 1 && proc.via_runguard) {
+      handle_status_event();
+    }
+
+    bool next_pass = proc.index == 1 && WIFEXITED(status) &&
+                     WEXITSTATUS(status) == 0 && !child_indicated_timelimit &&
+                     next_pass_requested();
 
     // Only set the first process if runguard didn't tell us about a TLE.
-    if (first_process_exit_id == -1 && !child_indicated_timelimit) {
+    if (first_process_exit_id == -1 && !child_indicated_timelimit &&
+        !next_pass) {
       first_process_exit_id = pid;
     }
 
-    // Search the exited process and store its exit information.
-    bool found = false;
-    for (auto &proc : processes) {
-      if (proc.pid != pid) {
-        continue;
-      }
+    proc.on_exit(status, usage);
 
-      proc.on_exit(status);
-      found = true;
-      break;
+    if (proc.index == 1 && is_multipass()) {
+      finish_pass();
+    }
+
+    if (next_pass) {
+      start_next_pass(output_file);
+      return true;
     }
 
     // One of the process exited, close all the fd. `close_fds` must be called
     // after `on_exit`.
-    for (auto &proc : processes) {
-      proc.close_fds();
+    for (auto &p : processes) {
+      p.close_fds();
     }
 
-    if (!found) {
-      error(0, "unknown child with pid {} exited", pid);
+    return true;
+  }
+
+  // Record the statistics of the run of the second process that just ended.
+  void finish_pass() {
+    auto duration = chrono::high_resolution_clock::now() - pass_start;
+    passes.push_back({
+        chrono::duration_cast<chrono::microseconds>(duration).count(),
+        total_bytes_transferred - pass_bytes_start,
+        processes[1].exit_code(),
+        submission_status,
+    });
+    logmsg(LOG_DEBUG, "pass {} finished", passes.size());
+  }
+
+  // The second process exited successfully and the interactor requested
+  // another pass: forward what is left in the pipe of the old process and
+  // connect the interactor to a new instance of it.
+  void start_next_pass(output_file_t &output_file) {
+    process_t &proc = processes[1];
+    if (proc.process_to_proxy != -1 && !processes[0].exited) {
+      pump_proxy_pipe(proc, processes[0], output_file);
+    }
+    proc.close_input_fd();
+    proc.close_output_fd();
+    // The interactor may already have sent input meant for the next pass.
+    string unconsumed = proc.take_unconsumed_input();
+
+    logmsg(LOG_INFO, "starting pass {}", passes.size() + 1);
+    proc.exited = false;
+    proc.exitInfo = -1;
+    make_proxy_input_pipe(proc);
+    make_proxy_output_pipe(proc);
+    proc.spawn(status_socket_path);
+    add_fd(proc.pidfd);
+    add_fd(proc.process_to_proxy);
+    if (!unconsumed.empty()) {
+      logmsg(LOG_DEBUG, "passing {} unconsumed bytes to pass {}",
+             unconsumed.size(), passes.size() + 1);
+      write_all(proc.proxy_to_process, unconsumed.data(), unconsumed.size());
     }
 
-    return true;
+    pass_start = chrono::high_resolution_clock::now();
+    pass_bytes_start = total_bytes_transferred;
+    submission_status.clear();
+    if (walltime_timer != -1) {
+      walltime_terminated = false;
+      arm_walltime_timer(args.walltime);
+    }
+  }
+
+  // Consume the pending messages on the status socket. Each message consists
+  // of `key: value` lines; a non-empty `time-result` tells us that the
+  // submission hit its time limit.
+  void handle_status_event() {
+    char buffer[4096];
+    while (true) {
+      ssize_t nread = recv(status_socket, buffer, sizeof(buffer), 0);
+      if (nread < 0) {
+        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+          return;
+        }
+        error(errno, "failed to read from status socket");
+      }
+
+      istringstream message(string(buffer, nread));
+      string line;
+      while (getline(message, line)) {
+        size_t sep = line.find(": ");
+        if (sep == string::npos) {
+          warning(0, "ignoring malformed status line from runguard: {}", line);
+          continue;
+        }
+        string key = line.substr(0, sep);
+        string value = line.substr(sep + 2);
+        logmsg(LOG_DEBUG, "runguard status: {} = {}", key, value);
+        if (key == "time-result" && !value.empty()) {
+          if (!child_indicated_timelimit) {
+            logmsg(LOG_WARNING, "child indicated TLE");
+          }
+          child_indicated_timelimit = true;
+        }
+        submission_status[key] = value;
+      }
+    }
   }
 
   // Check if every process has exited.
@@ -797,19 +1357,15 @@ struct state_t {
       // write an extra \n at its end.
       ssize_t nread = read(from.process_to_proxy, buffer, BUF_SIZE - 1);
       if (nread == 0) {
-        auto duration = chrono::steady_clock::now() - output_file.start;
-        auto time = duration.count() / 1000 / 1000; // ns -> ms
-        int time_sec = time / 1000;
-        int time_millis = time % 1000;
-        char direction = from.index == 0 ? ']' : '[';
-        char eofbuf[128];
-        snprintf(eofbuf, sizeof(eofbuf), "[%3d.%03ds/%ld]%c", time_sec, time_millis, 0L, direction);
-        write_all(output_file.output_file, eofbuf, strlen(eofbuf));
+        output_file.write_eof(from);
 
         warning(0, "EOF from process #{}", from.index);
         // The process closed stdout, we need to close the pipe's file
-        // descriptors as well.
-        to.close_input_fd();
+        // descriptors as well. Keep the interactor's input open if it
+        // will talk to the next pass of the second process.
+        if (from.index == 0 || !next_pass_requested()) {
+          to.close_input_fd();
+        }
         from.close_output_fd();
         return;
       }
@@ -834,12 +1390,17 @@ struct state_t {
   void epoll_loop() {
     output_file_t output_file(args.output_file);
 
-    // We can only receive 2 types of events:
-    // - a child exited
+    // We can only receive 4 types of events:
+    // - a child exited (one pidfd for each child process)
+    // - runguard reported the submission status
+    // - the wall clock limit of the second process expired
     // - some data is ready in a proxy's pipe (at most one for each child
     // process)
-    const int MAX_EVENTS = 1 + 2;
+    const int MAX_EVENTS = 2 + 1 + 1 + 2;
     epoll_event events[MAX_EVENTS];
+    if (args.in_process) {
+      start_interactor(output_file);
+    }
     while (true) {
       // This will block until an event is ready.
       int num_events = epoll_wait(epoll_fd, events, MAX_EVENTS, -1);
@@ -856,14 +1417,24 @@ struct state_t {
         auto &event = events[i];
         fd_t fd = event.data.fd;
 
-        // The exit signal handler noticed a child's exit.
-        if (fd == child_exited_pipe) {
-          logmsg(LOG_DEBUG, "caught SIGCHLD signal");
-          // Consume all the exited children.
-          while (handle_child_exit()) {
-            if (has_everyone_exited()) {
-              goto finish;
-            }
+        if (fd == status_socket) {
+          handle_status_event();
+          continue;
+        }
+        if (fd == walltime_timer) {
+          handle_walltime_event();
+          continue;
+        }
+
+        // The pidfd of a child became readable, i.e. it exited.
+        auto exited = find_if(processes.begin(), processes.end(),
+                              [fd](const process_t &p) { return p.pidfd == fd; });
+        if (exited != processes.end()) {
+          if (!handle_child_exit(*exited, output_file)) {
+            continue;
+          }
+          if (has_everyone_exited()) {
+            goto finish;
           }
           // If the main process crashed (with a signal) something bad is
           // happening and the communication with the other process may be very
@@ -874,19 +1445,6 @@ struct state_t {
           }
           continue;
         }
-        if (fd == child_timelimit_pipe) {
-          logmsg(LOG_DEBUG, "caught SIGUSR1 signal");
-          static char buffer[1];
-          if (read(child_timelimit_pipe, buffer, 1) != 1) {
-            if (errno != EAGAIN && errno != EWOULDBLOCK) {
-              error(errno, "failed to read from tle pipe");
-            }
-          } else if (buffer[0] == 42) {
-            logmsg(LOG_WARNING, "child indicated TLE");
-            child_indicated_timelimit = true;
-            continue;
-          }
-        }
 
         // A process wrote in one of the pipes to the proxy.
         for (size_t j = 0; j < processes.size(); j++) {
@@ -906,12 +1464,28 @@ struct state_t {
 
   finish:
     logmsg(LOG_DEBUG, "all processes exited");
+    // runguard sends its final status right before exiting, so it may only
+    // be queued now.
+    handle_status_event();
     if (!args.output_file.empty()) {
       logmsg(LOG_INFO, "total communication amount: {} KiB",
              total_bytes_transferred / 1024);
     }
   }
 
+  // Write the status of the submission as reported by runguard to the meta
+  // file, with the given prefix for the keys.
+  static void write_submission_status(ofstream &meta, const string &prefix,
+                                      const map<string, string> &status) {
+    for (const char *key : {"time-result", "wall-time", "cpu-time",
+                            "memory-bytes", "exitcode"}) {
+      auto it = status.find(key);
+      if (it != status.end()) {
+        meta << prefix << key << ": " << it->second << endl;
+      }
+    }
+  }
+
   // Write the metadata to file, if enabled.
   void write_meta() {
     if (args.meta_file.empty()) {
@@ -930,6 +1504,38 @@ struct state_t {
     meta << "validator-exited-first: "
          << (first_process_exit_id == main_process().pid ? "true" : "false")
          << endl;
+    // Forward the limit status and resource usage of the submission.
+    write_submission_status(meta, "submission-", submission_status);
+    // Resource usage of the processes as seen by us. For the second process
+    // this includes the overhead of runguard, if it is used.
+    for (auto &proc : processes) {
+      const char *prefix = proc.index == 0 ? "validator-" : "submission-process-";
+      auto wall_us =
+          chrono::duration_cast<chrono::microseconds>(proc.wall_time).count();
+      meta << prefix << "wall-time: " << std::format("{:.3f}", wall_us / 1e6)
+           << endl;
+      meta << prefix << "user-time: " << std::format("{:.3f}", proc.user_time)
+           << endl;
+      meta << prefix << "sys-time: " << std::format("{:.3f}", proc.sys_time)
+           << endl;
+      meta << prefix << "cpu-time: "
+           << std::format("{:.3f}", proc.user_time + proc.sys_time) << endl;
+      meta << prefix << "memory-bytes: " << proc.max_rss_kib * 1024 << endl;
+    }
+    if (is_multipass()) {
+      meta << "passes: " << passes.size() << endl;
+      for (size_t i = 0; i < passes.size(); i++) {
+        meta << "pass-" << i + 1 << "-duration-us: " << passes[i].duration_us
+             << endl;
+        meta << "pass-" << i + 1 << "-bytes-transferred: "
+             << passes[i].bytes_transferred << endl;
+        meta << "pass-" << i + 1 << "-exitcode: " << passes[i].exit_code
+             << endl;
+        write_submission_status(
+            meta, "pass-" + to_string(i + 1) + "-submission-",
+            passes[i].submission_status);
+      }
+    }
   }
 };
 
@@ -946,16 +1552,27 @@ int main(int argc, char **argv) {
   signal(SIGPIPE, SIG_IGN);
 
   state_t::install_sigterm_handler();
-  state.install_sigchld_handler();
-  state.install_sigusr1_handler();
+  state.setup_status_socket();
+  state.setup_walltime_timer();
 
+  if (state.args.in_process) {
+    state.load_interactor();
+  }
   state.setup_pipes();
   for (auto &proc : state.processes) {
-    proc.spawn();
+    // The in-process interactor is started by the event loop.
+    if (proc.index == 0 && state.args.in_process) {
+      continue;
+    }
+    proc.spawn(state.status_socket_path);
   }
+  // All children are started, write messages from the event loop in the
+  // background.
+  log_async_start();
 
   state.init_epoll();
   state.epoll_loop();
+  state.cleanup_status_socket();
   state.write_meta();
 
   if (state.args.verbose) {
@@ -0,0 +1,66 @@
+/*
+ * runpipe_interactor.h -- C ABI for interactors loaded into runpipe.
+ *
+ * Part of the DOMjudge Programming Contest Jury System and licensed
+ * under the GNU GPL. See README and COPYING for details.
+ *
+ * With `runpipe -I', the first command is not executed as a separate
+ * process, but loaded as a shared object into runpipe and run in a thread
+ * of it. This saves the context switches and copies of the pipes between
+ * the interactor and runpipe, which dominate the runtime of problems with
+ * many short messages. The submission is still run as a separate process.
+ *
+ * The shared object must export the functions below. Communication with the
+ * submission must go through the callbacks: the stdin/stdout of the shared
+ * object are those of runpipe, which are not connected to the submission.
+ * It shares the C library with runpipe, so it must not change the signal
+ * dispositions or call exit(). Everything written through the
+ * callbacks ends up in the transcript (`-o') exactly as if it had been
+ * written by an interactor process.
+ */
+
+#ifndef RUNPIPE_INTERACTOR_H
+#define RUNPIPE_INTERACTOR_H
+
+#include <stddef.h>
+#include <sys/types.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Bump on every incompatible change of the structures or functions below. */
+#define RUNPIPE_INTERACTOR_ABI_VERSION 1
+
+struct runpipe_io {
+	/* Opaque pointer to be passed to the callbacks. */
+	void *ctx;
+
+	/* Read at most 'len' bytes of output of the submission into 'buf'.
+	 * Blocks until data is available. Returns the number of bytes read,
+	 * 0 on end of file and -1 on error with errno set. */
+	ssize_t (*read)(void *ctx, void *buf, size_t len);
+
+	/* Write 'len' bytes from 'buf' to the input of the submission. Blocks
+	 * until all data is written. Returns 'len' on success and -1 on error
+	 * with errno set, e.g. EPIPE if the submission closed its input. */
+	ssize_t (*write)(void *ctx, const void *buf, size_t len);
+
+	/* Close the input of the submission, signalling end of file. */
+	void (*close)(void *ctx);
+};
+
+/* Must return RUNPIPE_INTERACTOR_ABI_VERSION as compiled in. */
+int runpipe_interactor_abi_version(void);
+
+/* Run the interactor. 'argc' and 'argv' are as for main() of an interactor
+ * process, including argv[0] being the path of the shared object. The return
+ * value is used as exit code of the interactor. This function is called at
+ * most once per loaded object, from a thread other than the main thread. */
+int runpipe_interactor_main(int argc, char **argv, const struct runpipe_io *io);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* RUNPIPE_INTERACTOR_H */
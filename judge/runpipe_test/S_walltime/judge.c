@@ -0,0 +1,14 @@
+#include <assert.h>
+#include <signal.h>
+#include <stdio.h>
+int main() {
+  signal(SIGPIPE, SIG_IGN);
+  assert(4 == printf("123\n"));
+  fflush(stdout);
+
+  // The solution never answers, so we only get EOF once it is killed.
+  int x;
+  if (scanf("%d", &x) != 1)
+    return 43;
+  return 42;
+}
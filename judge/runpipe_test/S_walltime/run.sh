@@ -0,0 +1,9 @@
+#!/usr/bin/env bash
+
+[[ $# != 1 ]] && echo "Usage: $0 runpipe" && exit 2
+
+source ../check.sh
+should_exit_with 43 "$1" -t 0.2 -M meta.txt ./judge 42 = ./solution 42
+grep -q "submission-time-result: hard-timelimit" meta.txt || exit 1
+grep -q "submission-process-wall-time: 0.2" meta.txt || exit 1
+should_exit_with 43 "$1" -t 0.2 -o output.txt ./judge 42 = ./solution 42
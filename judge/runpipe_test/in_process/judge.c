@@ -0,0 +1,32 @@
+#include <string.h>
+
+#include "../../runpipe_interactor.h"
+
+int runpipe_interactor_abi_version(void) {
+  return RUNPIPE_INTERACTOR_ABI_VERSION;
+}
+
+int runpipe_interactor_main(int argc, char **argv,
+                            const struct runpipe_io *io) {
+  (void)argv;
+  if (argc != 2)
+    return 44;
+
+  for (int round = 0; round < 1000; round++) {
+    if (io->write(io->ctx, "123\n", 4) != 4)
+      return 43;
+
+    char line[8];
+    size_t len = 0;
+    while (len < 4) {
+      ssize_t nread = io->read(io->ctx, line + len, 4 - len);
+      if (nread <= 0)
+        return 43;
+      len += nread;
+    }
+    if (memcmp(line, "123\n", 4) != 0)
+      return 43;
+  }
+  io->close(io->ctx);
+  return 42;
+}
@@ -0,0 +1,10 @@
+#!/usr/bin/env bash
+
+[[ $# != 1 ]] && echo "Usage: $0 runpipe" && exit 2
+
+source ../check.sh
+should_exit_with 42 "$1" -I -M meta.txt ./judge 42 = ./solution 42
+grep -q "bytes-transferred: 8000" meta.txt || { echo "wrong meta"; cat meta.txt; exit 1; }
+should_exit_with 42 "$1" -I -o output.txt ./judge 42 = ./solution 42
+grep -q "\]$" output.txt || { echo "missing EOF marker"; exit 1; }
+should_exit_with 44 "$1" -I ./judge = ./solution
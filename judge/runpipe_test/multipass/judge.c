@@ -0,0 +1,26 @@
+#include <assert.h>
+#include <signal.h>
+#include <stdio.h>
+int main(int argc, char **argv) {
+  signal(SIGPIPE, SIG_IGN);
+  assert(argc == 2);
+  char nextpass[256];
+  snprintf(nextpass, sizeof(nextpass), "%s/nextpass.resident", argv[1]);
+
+  for (int pass = 1; pass <= 3; pass++) {
+    // Request the next pass before the solution can exit.
+    if (pass < 3) {
+      FILE *f = fopen(nextpass, "a");
+      assert(f != NULL);
+      fprintf(f, "next\n");
+      fclose(f);
+    }
+    assert(printf("%d\n", pass) > 0);
+    fflush(stdout);
+
+    int x;
+    if (scanf("%d", &x) != 1 || x != 2 * pass)
+      return 43;
+  }
+  return 42;
+}
@@ -0,0 +1,14 @@
+#!/usr/bin/env bash
+
+[[ $# != 1 ]] && echo "Usage: $0 runpipe" && exit 2
+
+source ../check.sh
+rm -rf feedback && mkdir feedback
+should_exit_with 42 "$1" -p 3 -F feedback -M meta.txt ./judge feedback = ./solution
+grep -q "passes: 3" meta.txt || exit 1
+rm -rf feedback && mkdir feedback
+should_exit_with 42 "$1" -p 3 -F feedback -o output.txt ./judge feedback = ./solution
+# Without enough passes, the interactor gets EOF in the second pass.
+rm -rf feedback && mkdir feedback
+should_exit_with 43 "$1" -p 1 -F feedback ./judge feedback = ./solution
+rm -rf feedback
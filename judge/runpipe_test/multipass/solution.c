@@ -0,0 +1,8 @@
+#include <assert.h>
+#include <stdio.h>
+
+int main() {
+  int x;
+  assert(1 == scanf("%d", &x));
+  printf("%d\n", 2 * x);
+}
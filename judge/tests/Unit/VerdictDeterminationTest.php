@@ -24,7 +24,7 @@ class VerdictDeterminationTest extends TestCase
     {
         $reflection = new ReflectionClass(JudgeDaemon::class);
         $method = $reflection->getMethod('getVerdictMessage');
-        return $method->invoke($this->daemon, $verdict, $input->programMeta, $input->compareMeta, $input->combinedRunCompare, $filelimit);
+        return $method->invoke($this->daemon, $verdict, $input->programMeta, $input->compareMeta, $input->combinedRunCompare, $filelimit, $input->stoppedEarly);
     }
 
     /**
@@ -38,6 +38,7 @@ class VerdictDeterminationTest extends TestCase
         bool $combinedRunCompare = false,
         int $programOutSize = 100,
         bool $compareTimedOut = false,
+        bool $stoppedEarly = false,
     ): VerdictInput {
         $defaultProgramMeta = [
             'cpu-time' => '0.1',
@@ -64,6 +65,7 @@ class VerdictDeterminationTest extends TestCase
             combinedRunCompare: $combinedRunCompare,
             programOutSize: $programOutSize,
             compareTimedOut: $compareTimedOut,
+            stoppedEarly: $stoppedEarly,
         );
     }
 
@@ -313,4 +315,41 @@ class VerdictDeterminationTest extends TestCase
         $this->assertEquals(Verdict::WRONG_ANSWER, $verdict);
         $this->assertEquals('Wrong answer!', $this->callGetVerdictMessage($verdict, $input));
     }
+
+    public function testStreamingStoppedEarlyOverridesRunError(): void
+    {
+        $input = $this->makeInput(
+            programMeta: ['exitcode' => '143'],
+            compareExitcode: 43,
+            stoppedEarly: true,
+        );
+        $verdict = $this->daemon->determineVerdict($input);
+        $this->assertEquals(Verdict::WRONG_ANSWER, $verdict);
+        $this->assertEquals(
+            'Submission stopped early, validator already rejected its output. Wrong answer!',
+            $this->callGetVerdictMessage($verdict, $input)
+        );
+    }
+
+    public function testStreamingStoppedEarlyOverridesNoOutput(): void
+    {
+        $input = $this->makeInput(
+            compareExitcode: 43,
+            programOutSize: 0,
+            stoppedEarly: true,
+        );
+        $verdict = $this->daemon->determineVerdict($input);
+        $this->assertEquals(Verdict::WRONG_ANSWER, $verdict);
+    }
+
+    public function testStreamingStoppedEarlyDoesNotOverrideCompareError(): void
+    {
+        $input = $this->makeInput(
+            programMeta: ['exitcode' => '143'],
+            compareExitcode: 1,
+            stoppedEarly: true,
+        );
+        $verdict = $this->daemon->determineVerdict($input);
+        $this->assertEquals(Verdict::COMPARE_ERROR, $verdict);
+    }
 }
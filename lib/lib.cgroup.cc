@@ -0,0 +1,318 @@
+/*
+ * Access to Linux cgroup v2 groups through the cgroup filesystem.
+ *
+ * Part of the DOMjudge Programming Contest Jury System and licensed
+ * under the GNU GPL. See README and COPYING for details.
+ */
+
+#include "lib.cgroup.hpp"
+
+#include <cerrno>
+#include <cinttypes>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/* Time to wait for a notification that the group is empty before checking
+ * again, in milliseconds. */
+#define KILL_POLL_TIMEOUT 100
+
+/* Close a file descriptor while keeping errno intact. */
+static void close_fd(int &fd)
+{
+	if ( fd<0 ) return;
+	int saved_errno = errno;
+	::close(fd);
+	errno = saved_errno;
+	fd = -1;
+}
+
+/* Whether the space separated 'list' contains 'word'. */
+static bool has_word(const char *list, const char *word)
+{
+	size_t len = strlen(word);
+	for(const char *p = list; (p = strstr(p, word))!=nullptr; p += len) {
+		if ( (p==list || p[-1]==' ') && (p[len]==0 || p[len]==' ' || p[len]=='\n') ) {
+			return true;
+		}
+	}
+	return false;
+}
+
+/* Read the value of entry 'key' from a flat keyed file like cpu.stat, which
+ * consists of lines "key value". Reads the file in chunks into a buffer on
+ * the stack. Fails with ENOENT if there is no such entry. */
+static int64_t read_entry(int fd, const char *key)
+{
+	char buf[4096];
+	size_t keylen = strlen(key);
+	size_t have = 0;
+	off_t offset = 0;
+
+	while ( true ) {
+		ssize_t nread = pread(fd, buf+have, sizeof(buf)-1-have, offset);
+		if ( nread<0 ) return -1;
+		offset += nread;
+		have += nread;
+		buf[have] = 0;
+
+		char *line = buf, *end;
+		while ( (end = strchr(line, '\n'))!=nullptr || (nread==0 && *line!=0) ) {
+			if ( strncmp(line, key, keylen)==0 && line[keylen]==' ' ) {
+				return strtoll(line+keylen+1, nullptr, 10);
+			}
+			if ( end==nullptr ) break;
+			line = end + 1;
+		}
+		if ( nread==0 ) break;
+
+		/* Keep the incomplete last line, unless it fills the buffer:
+		 * then it is too long to be an entry we look for. */
+		have = (buf + have) - line;
+		if ( have==sizeof(buf)-1 ) have = 0;
+		memmove(buf, line, have);
+	}
+
+	errno = ENOENT;
+	return -1;
+}
+
+/* Enable the controllers for the children of the group at 'fd', if they
+ * are not yet. */
+static int enable_controllers(int fd, std::initializer_list<const char *> controllers)
+{
+	if ( controllers.size()==0 ) return 0;
+
+	char enabled[1024];
+	int ctlfd = openat(fd, "cgroup.subtree_control", O_RDWR | O_CLOEXEC);
+	if ( ctlfd<0 ) return -1;
+
+	ssize_t nread = pread(ctlfd, enabled, sizeof(enabled)-1, 0);
+	if ( nread<0 ) {
+		close_fd(ctlfd);
+		return -1;
+	}
+	enabled[nread] = 0;
+
+	for(const char *controller : controllers) {
+		if ( has_word(enabled, controller) ) continue;
+
+		char change[64];
+		int len = snprintf(change, sizeof(change), "+%s", controller);
+		if ( len<0 || (size_t)len>=sizeof(change) ) {
+			close_fd(ctlfd);
+			errno = EINVAL;
+			return -1;
+		}
+		if ( write(ctlfd, change, len)!=len ) {
+			close_fd(ctlfd);
+			return -1;
+		}
+	}
+
+	return ::close(ctlfd);
+}
+
+/* Open the directory of the group 'name' below 'root', creating it and its
+ * parents when 'create' is set. Sets parentfd and basename. */
+static int open_group(const char *root, const char *name, bool create,
+                      std::initializer_list<const char *> controllers,
+                      int &parentfd, char (&basename)[256])
+{
+	int fd = open(root, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if ( fd<0 ) return -1;
+
+	const char *pos = name;
+	while ( true ) {
+		while ( *pos=='/' ) pos++;
+		size_t len = strcspn(pos, "/");
+		if ( len==0 ) break;
+		if ( len>=sizeof(basename) ) {
+			close_fd(fd);
+			errno = ENAMETOOLONG;
+			return -1;
+		}
+		memcpy(basename, pos, len);
+		basename[len] = 0;
+		pos += len;
+
+		bool last = ( pos[strspn(pos, "/")]==0 );
+		if ( create ) {
+			if ( enable_controllers(fd, controllers)!=0 ||
+			     (mkdirat(fd, basename, 0755)!=0 && (last || errno!=EEXIST)) ) {
+				close_fd(fd);
+				return -1;
+			}
+		}
+		if ( last ) {
+			parentfd = fd;
+			return 0;
+		}
+
+		int next = openat(fd, basename, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+		close_fd(fd);
+		if ( next<0 ) return -1;
+		fd = next;
+	}
+
+	close_fd(fd);
+	errno = EINVAL;
+	return -1;
+}
+
+int cgroup_v2::open_files()
+{
+	if ( (dirfd      = openat(parentfd, basename, O_RDONLY | O_DIRECTORY | O_CLOEXEC))<0 ||
+	     (procs_fd   = openat(dirfd, "cgroup.procs",  O_RDWR   | O_CLOEXEC))<0 ||
+	     (events_fd  = openat(dirfd, "cgroup.events", O_RDONLY | O_CLOEXEC))<0 ||
+	     (cpu_stat_fd= openat(dirfd, "cpu.stat",      O_RDONLY | O_CLOEXEC))<0 ) {
+		close();
+		return -1;
+	}
+
+	/* These are missing on older kernels or without the memory controller. */
+	if ( (kill_fd = openat(dirfd, "cgroup.kill", O_WRONLY | O_CLOEXEC))<0 && errno!=ENOENT ) {
+		close();
+		return -1;
+	}
+	if ( (peak_fd = openat(dirfd, "memory.peak", O_RDONLY | O_CLOEXEC))<0 ) {
+		if ( errno!=ENOENT ) {
+			close();
+			return -1;
+		}
+		peak_errno = errno;
+	}
+
+	return 0;
+}
+
+int cgroup_v2::create(const char *name, std::initializer_list<const char *> controllers,
+                      const char *root)
+{
+	close();
+	if ( open_group(root, name, true, controllers, parentfd, basename)!=0 ) return -1;
+	return open_files();
+}
+
+int cgroup_v2::open(const char *name, const char *root)
+{
+	close();
+	if ( open_group(root, name, false, {}, parentfd, basename)!=0 ) return -1;
+	return open_files();
+}
+
+void cgroup_v2::close()
+{
+	for(int *fd : { &parentfd, &dirfd, &procs_fd, &events_fd, &kill_fd, &peak_fd, &cpu_stat_fd }) {
+		close_fd(*fd);
+	}
+	peak_errno = 0;
+}
+
+int cgroup_v2::set(const char *file, const char *value)
+{
+	int fd = openat(dirfd, file, O_WRONLY | O_CLOEXEC);
+	if ( fd<0 ) return -1;
+
+	ssize_t len = strlen(value);
+	if ( write(fd, value, len)!=len ) {
+		close_fd(fd);
+		return -1;
+	}
+	return ::close(fd);
+}
+
+int cgroup_v2::set(const char *file, uint64_t value)
+{
+	char str[32];
+	snprintf(str, sizeof(str), "%" PRIu64, value);
+	return set(file, str);
+}
+
+int cgroup_v2::add_process(pid_t pid)
+{
+	char str[32];
+	int len = snprintf(str, sizeof(str), "%d", (int)pid);
+	if ( write(procs_fd, str, len)!=len ) return -1;
+	return 0;
+}
+
+int cgroup_v2::has_processes()
+{
+	char buf[32];
+	ssize_t nread = pread(procs_fd, buf, sizeof(buf), 0);
+	if ( nread<0 ) return -1;
+	return nread>0;
+}
+
+int64_t cgroup_v2::memory_peak()
+{
+	if ( peak_fd<0 ) {
+		errno = peak_errno ? peak_errno : EBADF;
+		return -1;
+	}
+
+	char buf[32];
+	ssize_t nread = pread(peak_fd, buf, sizeof(buf)-1, 0);
+	if ( nread<0 ) return -1;
+	buf[nread] = 0;
+	return strtoll(buf, nullptr, 10);
+}
+
+int64_t cgroup_v2::cpu_stat(const char *key)
+{
+	return read_entry(cpu_stat_fd, key);
+}
+
+int64_t cgroup_v2::read_stat(const char *file, const char *key)
+{
+	int fd = openat(dirfd, file, O_RDONLY | O_CLOEXEC);
+	if ( fd<0 ) return -1;
+
+	int64_t value = read_entry(fd, key);
+	close_fd(fd);
+	return value;
+}
+
+int cgroup_v2::kill()
+{
+	if ( kill_fd>=0 && write(kill_fd, "1", 1)!=1 ) return -1;
+
+	while ( true ) {
+		/* Reading cgroup.events also resets its poll notification. */
+		int64_t populated = read_entry(events_fd, "populated");
+		if ( populated<0 ) return -1;
+		if ( populated==0 ) return 0;
+
+		/* Without cgroup.kill, kill the processes one by one. They may
+		 * fork in between, hence the loop. */
+		if ( kill_fd<0 ) {
+			char buf[4096];
+			ssize_t nread = pread(procs_fd, buf, sizeof(buf)-1, 0);
+			if ( nread<0 ) return -1;
+			buf[nread] = 0;
+			for(char *pid = buf, *end; *pid!=0; pid = end) {
+				long value = strtol(pid, &end, 10);
+				/* Skip a PID cut off at the end of the buffer. */
+				if ( end==pid || *end!='\n' ) break;
+				::kill((pid_t)value, SIGKILL);
+			}
+		}
+
+		/* cgroup.events is modified when the group becomes empty. */
+		struct pollfd pfd = { events_fd, POLLPRI, 0 };
+		if ( poll(&pfd, 1, KILL_POLL_TIMEOUT)<0 && errno!=EINTR ) return -1;
+	}
+}
+
+int cgroup_v2::remove()
+{
+	if ( unlinkat(parentfd, basename, AT_REMOVEDIR)!=0 ) return -1;
+	close();
+	return 0;
+}
@@ -0,0 +1,94 @@
+/*
+ * Access to Linux cgroup v2 groups through the cgroup filesystem.
+ *
+ * Part of the DOMjudge Programming Contest Jury System and licensed
+ * under the GNU GPL. See README and COPYING for details.
+ */
+
+#ifndef LIB_CGROUP_HPP
+#define LIB_CGROUP_HPP
+
+#include <cstdint>
+#include <initializer_list>
+#include <sys/types.h>
+
+#define CGROUP_ROOT "/sys/fs/cgroup"
+
+/*
+ * A cgroup v2 group. The directory of the group and the control files that
+ * are read or written repeatedly are opened once, when the group is created
+ * or opened; reading statistics afterwards takes a single pread() into a
+ * buffer on the stack and does not allocate. All file descriptors are
+ * close-on-exec, so they can be used in a forked child until it executes
+ * a command.
+ *
+ * Like system calls, functions return -1 and set errno on errors.
+ */
+class cgroup_v2 {
+public:
+	cgroup_v2() = default;
+	cgroup_v2(const cgroup_v2&) = delete;
+	cgroup_v2& operator=(const cgroup_v2&) = delete;
+	~cgroup_v2() { close(); }
+
+	/* Create the group 'name', a path relative to 'root', including any
+	 * missing parent groups, and open it. The controllers are enabled for
+	 * the group in the cgroup.subtree_control of its parents where needed.
+	 * Fails with EEXIST if the group already exists. */
+	int create(const char *name, std::initializer_list<const char *> controllers,
+	           const char *root = CGROUP_ROOT);
+
+	/* Open the existing group 'name', a path relative to 'root'. */
+	int open(const char *name, const char *root = CGROUP_ROOT);
+
+	/* Close all file descriptors; does not remove the group. */
+	void close();
+
+	/* Write a value to the control file 'file' of the group. */
+	int set(const char *file, const char *value);
+	int set(const char *file, uint64_t value);
+
+	/* Move process 'pid' (0 for the calling process) into the group. */
+	int add_process(pid_t pid);
+
+	/* Return 1 if there are processes in the group, 0 if not. */
+	int has_processes();
+
+	/* Peak memory usage of the group in bytes from memory.peak. Fails with
+	 * ENOENT if the kernel does not support it (before Linux 5.19). */
+	int64_t memory_peak();
+
+	/* Value of entry 'key' of cpu.stat, e.g. "usage_usec". */
+	int64_t cpu_stat(const char *key);
+
+	/* Value of entry 'key' of any flat keyed file of the group, such as
+	 * memory.stat. Opens the file on every call. */
+	int64_t read_stat(const char *file, const char *key);
+
+	/* Kill all processes in the group and wait until they are gone. Uses
+	 * cgroup.kill when available (Linux 5.14 and newer). */
+	int kill();
+
+	/* Remove the group, which must have no processes left, and close it.
+	 * Fails with EBUSY if the kernel has not finished cleaning up after
+	 * the processes that were in it yet. */
+	int remove();
+
+	/* File descriptor of the directory of the group, or -1 if not open. */
+	int dir_fd() const { return dirfd; }
+
+private:
+	int parentfd = -1;          /* directory containing the group */
+	char basename[256] = "";    /* name of the group in there */
+	int dirfd = -1;
+	int procs_fd = -1;
+	int events_fd = -1;
+	int kill_fd = -1;
+	int peak_fd = -1;
+	int cpu_stat_fd = -1;
+	int peak_errno = 0;         /* why memory.peak could not be opened */
+
+	int open_files();
+};
+
+#endif /* LIB_CGROUP_HPP */
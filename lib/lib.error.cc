@@ -17,7 +17,12 @@
 #include <string>
 #include <iostream>
 #include <fstream>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <system_error>
 #include <unistd.h>
+#include <pthread.h>
 #include <chrono>
 
 /* Use program name in syslogging if defined */
@@ -35,38 +40,51 @@ int  loglevel     = LOG_DEBUG;
 static std::ofstream stdlog;
 int  syslog_open  = 0;
 
-/* Core logging implementation that accepts a fully formatted string */
-void logmsg_str(int msglevel, const std::string& mesg)
+/* Open the logfile and syslog if they are defined, once. */
+static std::once_flag sinks_opened;
+
+static void open_log_sinks()
 {
-	std::string buffer;
 	char *str, *endptr;
 	int syslog_fac;
 
 	/* Try to open logfile if it is defined */
 #ifdef LOGFILE
-	if (!stdlog.is_open()) {
-		stdlog.open(LOGFILE, std::ios::out | std::ios::app);
-	}
+	stdlog.open(LOGFILE, std::ios::out | std::ios::app);
 #endif
 
 	/* Try to open syslog if it is defined */
-	if ( ! syslog_open && (str=getenv("DJ_SYSLOG"))!=NULL ) {
+	if ( (str=getenv("DJ_SYSLOG"))!=NULL ) {
 		syslog_fac = strtol(str,&endptr,10);
 		if ( *endptr==0 ) {
 			openlog(PROGRAM, LOG_NDELAY | LOG_PID, syslog_fac);
 			syslog_open = 1;
 		}
 	}
+}
 
-	auto now = std::chrono::system_clock::now();
-	auto millis = std::chrono::duration_cast<std::chrono::milliseconds>(now.time_since_epoch()) % 1000;
+bool log_sinks_active()
+{
+	std::call_once(sinks_opened, open_log_sinks);
+	return stdlog.is_open() || syslog_open;
+}
+
+/* Serializes writing log messages from multiple threads */
+static std::mutex log_mutex;
+
+/* Write a message to stderr, the logfile and syslog; log_mutex must be held. */
+static void write_message(int msglevel, pid_t pid, std::chrono::system_clock::time_point time,
+                          std::string_view mesg)
+{
+	auto millis = std::chrono::duration_cast<std::chrono::milliseconds>(time.time_since_epoch()) % 1000;
 	std::string timestring = std::format("{:%b %d %H:%M:%S}.{:03d}",
-			std::chrono::floor<std::chrono::seconds>(now), millis.count());
+			std::chrono::floor<std::chrono::seconds>(time), millis.count());
 
 	// Construct the format string: "[time] progname[pid]: message\n"
+	std::string buffer;
 	buffer += "[" + timestring + "] ";
 	buffer += progname;
-	buffer += "[" + std::to_string(getpid()) + "]: ";
+	buffer += "[" + std::to_string(pid) + "]: ";
 	buffer += mesg;
 
 	if ( msglevel<=verbose ) {
@@ -77,6 +95,207 @@ void logmsg_str(int msglevel, const std::string& mesg)
 	}
 
 	if ( msglevel<=loglevel && syslog_open ) {
-		syslog(msglevel, "%s", mesg.c_str());
+		syslog(msglevel, "%.*s", (int)mesg.size(), mesg.data());
+	}
+}
+
+/*
+ * Asynchronous logging, see log_async_start(). Messages are queued in a
+ * bounded ring buffer, to which any thread can append without taking a lock:
+ * each slot has a sequence number that tells whether it is free for the
+ * writer at a position, or filled for the reader. A single flusher thread
+ * writes the messages out in order.
+ */
+#define LOG_RING_SIZE 256       /* must be a power of two */
+#define LOG_RECORD_SIZE 1000    /* longer messages are written synchronously */
+
+struct log_record {
+	std::atomic<size_t> seq;
+	int level;
+	pid_t pid;
+	std::chrono::system_clock::time_point time;
+	size_t len;
+	char text[LOG_RECORD_SIZE];
+};
+
+static log_record log_ring[LOG_RING_SIZE];
+static std::atomic<size_t> enqueue_pos;
+static size_t dequeue_pos;                  /* protected by log_mutex */
+static std::atomic<bool> async_active(false);
+static std::atomic<bool> flusher_stop(false);
+static std::atomic<unsigned> flusher_wakeup(0);
+static std::thread *flusher = nullptr;      /* never destroyed, see log_stop() */
+
+static void wake_flusher()
+{
+	flusher_wakeup.fetch_add(1, std::memory_order_release);
+	flusher_wakeup.notify_one();
+}
+
+/* Write out all complete messages in the ring buffer; log_mutex must be held. */
+static void drain_ring()
+{
+	while ( true ) {
+		log_record& rec = log_ring[dequeue_pos % LOG_RING_SIZE];
+		if ( rec.seq.load(std::memory_order_acquire)!=dequeue_pos+1 ) break;
+		write_message(rec.level, rec.pid, rec.time, std::string_view(rec.text, rec.len));
+		rec.seq.store(dequeue_pos + LOG_RING_SIZE, std::memory_order_release);
+		dequeue_pos++;
+	}
+}
+
+/* Append a message to the ring buffer. Returns false if it does not fit in
+ * a record. Waits for the flusher if the buffer is full. */
+static bool enqueue_message(int msglevel, const std::string& mesg)
+{
+	if ( mesg.size()>LOG_RECORD_SIZE ) return false;
+
+	auto now = std::chrono::system_clock::now();
+	size_t pos = enqueue_pos.load(std::memory_order_relaxed);
+	log_record *rec;
+	while ( true ) {
+		rec = &log_ring[pos % LOG_RING_SIZE];
+		size_t seq = rec->seq.load(std::memory_order_acquire);
+		if ( seq==pos ) {
+			if ( enqueue_pos.compare_exchange_weak(pos, pos+1, std::memory_order_relaxed) ) break;
+		} else if ( seq<pos ) {
+			/* Full: the flusher has not written the message in this slot yet. */
+			wake_flusher();
+			std::this_thread::yield();
+			pos = enqueue_pos.load(std::memory_order_relaxed);
+		} else {
+			pos = enqueue_pos.load(std::memory_order_relaxed);
+		}
+	}
+	rec->level = msglevel;
+	rec->pid = getpid();
+	rec->time = now;
+	rec->len = mesg.size();
+	memcpy(rec->text, mesg.data(), mesg.size());
+	rec->seq.store(pos+1, std::memory_order_release);
+	wake_flusher();
+	return true;
+}
+
+static void flusher_main()
+{
+	while ( true ) {
+		unsigned seen = flusher_wakeup.load(std::memory_order_acquire);
+		{
+			std::lock_guard<std::mutex> guard(log_mutex);
+			drain_ring();
+		}
+		if ( flusher_stop ) break;
+		flusher_wakeup.wait(seen, std::memory_order_acquire);
+	}
+}
+
+void log_flush()
+{
+	if ( !async_active ) return;
+	std::lock_guard<std::mutex> guard(log_mutex);
+	drain_ring();
+}
+
+/* Stop the flusher thread after it wrote all messages; called at exit. */
+static void log_stop()
+{
+	if ( !async_active.exchange(false) ) return;
+	flusher_stop = true;
+	wake_flusher();
+	flusher->join();
+	delete flusher;
+	flusher = nullptr;
+	/* Messages queued by other threads while stopping. */
+	std::lock_guard<std::mutex> guard(log_mutex);
+	drain_ring();
+}
+
+/* Around fork(), make sure the flusher is not halfway writing a message, and
+ * have the child log synchronously: it has no flusher thread. Messages queued
+ * before the fork are written by the parent only. */
+static void atfork_prepare()
+{
+	log_mutex.lock();
+	if ( async_active ) drain_ring();
+}
+
+static void atfork_parent()
+{
+	log_mutex.unlock();
+}
+
+static void atfork_child()
+{
+	async_active = false;
+	flusher = nullptr;
+	log_mutex.unlock();
+}
+
+void log_async_start()
+{
+	static std::once_flag started;
+	std::call_once(started, []() {
+		for (size_t i = 0; i < LOG_RING_SIZE; i++) {
+			log_ring[i].seq.store(i, std::memory_order_relaxed);
+		}
+		enqueue_pos = 0;
+		dequeue_pos = 0;
+		try {
+			flusher = new std::thread(flusher_main);
+		} catch (const std::system_error&) {
+			return; /* keep logging synchronously */
+		}
+		pthread_atfork(atfork_prepare, atfork_parent, atfork_child);
+		atexit(log_stop);
+		async_active = true;
+	});
+}
+
+/* Core logging implementation that accepts a fully formatted string */
+void logmsg_str(int msglevel, const std::string& mesg)
+{
+	log_sinks_active();
+
+	if ( async_active && enqueue_message(msglevel, mesg) ) return;
+
+	std::lock_guard<std::mutex> guard(log_mutex);
+	/* Keep the order with messages still queued. */
+	if ( async_active ) drain_ring();
+	write_message(msglevel, getpid(), std::chrono::system_clock::now(), mesg);
+}
+
+/* strerror_r() returns the message with GNU and a status with XSI. */
+[[maybe_unused]] static const char *strerror_result(const char *res, const char *)
+{
+	return res;
+}
+
+[[maybe_unused]] static const char *strerror_result(int res, const char *buf)
+{
+	return res==0 ? buf : "Unknown error";
+}
+
+/* Like strerror(), which need not be thread-safe. */
+std::string log_strerror(int errnum)
+{
+	char buf[256];
+	return strerror_result(strerror_r(errnum, buf, sizeof(buf)), buf);
+}
+
+std::string log_quote(std::string_view value)
+{
+	if ( !value.empty() && value.find_first_of(" \t\n\"=\\") == std::string_view::npos ) {
+		return std::string(value);
+	}
+	std::string res = "\"";
+	for (char c : value) {
+		if ( c=='"' || c=='\\' ) res += '\\';
+		if ( c=='\n' ) {
+			res += "\\n";
+			continue;
+		}
+		res += c;
 	}
+	return res + "\"";
 }
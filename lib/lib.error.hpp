@@ -31,8 +31,29 @@ extern std::string_view progname;
 extern int  verbose;
 extern int  loglevel;
 
-// Internal backend function (exposed for templates)
+// Internal backend functions (exposed for templates)
 void logmsg_str(int msglevel, const std::string& mesg);
+bool log_sinks_active();
+std::string log_quote(std::string_view value);
+std::string log_strerror(int errnum);
+
+/* Whether a message of this level is written anywhere. Checked before
+ * formatting, so that disabled debug messages cost next to nothing. */
+inline bool log_enabled(int level) {
+    return level <= verbose || (level <= loglevel && log_sinks_active());
+}
+
+/**
+ * Switch to asynchronous logging: messages are queued and written by a
+ * background thread, so that logging does not block the caller on writes
+ * to stderr, the logfile or syslog. Messages are written in order and all
+ * are flushed at exit. Call this after the program is done forking child
+ * processes: a child forked later logs synchronously again.
+ */
+void log_async_start();
+
+/* Write out all queued messages, e.g. before a call to _exit(). */
+void log_flush();
 
 /**
  * These functions accept std::format style strings and arguments.
@@ -41,6 +62,7 @@ void logmsg_str(int msglevel, const std::string& mesg);
 
 template<typename... Args>
 void logmsg(int level, std::format_string<Args...> fmt, Args&&... args) {
+    if (!log_enabled(level)) return;
     try {
         std::string msg = std::format(fmt, std::forward<Args>(args)...);
         logmsg_str(level, msg);
@@ -52,12 +74,13 @@ void logmsg(int level, std::format_string<Args...> fmt, Args&&... args) {
 // Helper for error/warning/logerror
 template<typename... Args>
 void log_helper(int level, const char* prefix, int errnum, std::format_string<Args...> fmt, Args&&... args) {
+    if (!log_enabled(level)) return;
     try {
         std::string user_msg = std::format(fmt, std::forward<Args>(args)...);
         std::string err_descr;
         
         if (errnum != 0) {
-            err_descr = std::strerror(errnum);
+            err_descr = log_strerror(errnum);
         }
 
         std::string buffer;
@@ -72,6 +95,36 @@ void log_helper(int level, const char* prefix, int errnum, std::format_string<Ar
     }
 }
 
+inline void log_fields(std::string&) {}
+
+template<typename Value, typename... Rest>
+void log_fields(std::string& buffer, std::string_view key, Value&& value, Rest&&... rest) {
+    buffer += ' ';
+    buffer += key;
+    buffer += '=';
+    buffer += log_quote(std::format("{}", std::forward<Value>(value)));
+    log_fields(buffer, std::forward<Rest>(rest)...);
+}
+
+/**
+ * Log a message followed by structured fields in logfmt style, given as
+ * alternating keys and values. Values are quoted when needed.
+ * Example: logmsg_kv(LOG_INFO, "run finished", "exitcode", 0, "time", 0.25);
+ * gives "run finished exitcode=0 time=0.25".
+ */
+template<typename... Fields>
+void logmsg_kv(int level, std::string_view msg, Fields&&... fields) {
+    static_assert(sizeof...(Fields) % 2 == 0, "logmsg_kv expects key/value pairs");
+    if (!log_enabled(level)) return;
+    try {
+        std::string buffer(msg);
+        log_fields(buffer, std::forward<Fields>(fields)...);
+        logmsg_str(level, buffer);
+    } catch (const std::format_error& e) {
+        logmsg_str(LOG_ERR, std::string("Format error in logmsg_kv: ") + e.what());
+    }
+}
+
 template<typename... Args>
 void error(int errnum, std::format_string<Args...> fmt, Args&&... args) {
     log_helper(LOG_ERR, "error: ", errnum, fmt, std::forward<Args>(args)...);
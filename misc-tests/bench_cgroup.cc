@@ -0,0 +1,232 @@
+/*
+ * Benchmark the cgroup v2 helpers of lib/lib.cgroup.cc against libcgroup,
+ * doing the cgroup operations that runguard does for every run.
+ *
+ * Build from this directory with:
+ *
+ *   g++ -std=c++20 -O2 -I../lib bench_cgroup.cc ../lib/lib.cgroup.cc -lcgroup -o bench_cgroup
+ *
+ * (leave out -lcgroup when libcgroup is not installed to benchmark only the
+ * helpers) and run as root on a system set up with create_cgroups:
+ *
+ *   ./bench_cgroup [-n RUNS] [-s READS] [PARENT]
+ *
+ * Each run creates the cgroup PARENT/bench_<pid>_<run> (PARENT defaults to
+ * domjudge) with a memory limit, moves a child process into it that exits
+ * right away, reads memory.peak and cpu.stat READS times (default 1), kills
+ * anything left and deletes the cgroup. Reports the mean time of each step.
+ */
+
+#include "lib.cgroup.hpp"
+
+#include <chrono>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <csignal>
+#include <getopt.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#if __has_include(<libcgroup.h>)
+#include <libcgroup.h>
+#define HAVE_LIBCGROUP 1
+#endif
+
+#define MEMORY_LIMIT (512ULL << 20)
+
+using bench_clock = std::chrono::steady_clock;
+
+enum { STEP_CREATE, STEP_ATTACH, STEP_STATS, STEP_KILL, STEP_DELETE, NUM_STEPS };
+const char *step_names[NUM_STEPS] = { "create", "attach", "stats", "kill", "delete" };
+
+struct timings {
+	double total[NUM_STEPS] = {};
+	bench_clock::time_point last;
+
+	void start() { last = bench_clock::now(); }
+	void stop(int step)
+	{
+		auto now = bench_clock::now();
+		total[step] += std::chrono::duration<double, std::micro>(now - last).count();
+		last = now;
+	}
+};
+
+[[noreturn]] void fail(const char *what, int errnum)
+{
+	if ( errnum!=0 ) {
+		fprintf(stderr, "bench_cgroup: %s: %s\n", what, strerror(errnum));
+	} else {
+		fprintf(stderr, "bench_cgroup: %s failed\n", what);
+	}
+	exit(1);
+}
+
+/* Fork a child that runs 'attach' and exits, and wait for it. */
+template<typename F>
+void run_child(F attach)
+{
+	pid_t pid = fork();
+	if ( pid<0 ) fail("fork", errno);
+	if ( pid==0 ) _exit(attach() ? 1 : 0);
+
+	int status;
+	if ( waitpid(pid, &status, 0)<0 ) fail("waitpid", errno);
+	if ( !WIFEXITED(status) || WEXITSTATUS(status)!=0 ) fail("moving child to cgroup", 0);
+}
+
+void bench_native(const char *name, int reads, timings &t)
+{
+	cgroup_v2 cg;
+
+	t.start();
+	if ( cg.create(name, { "memory" })!=0 ) fail("creating cgroup", errno);
+	if ( cg.set("memory.max", MEMORY_LIMIT)!=0 ||
+	     cg.set("memory.swap.max", (uint64_t)0)!=0 ) fail("setting memory limits", errno);
+	t.stop(STEP_CREATE);
+
+	run_child([&]() { return cg.add_process(0); });
+	t.stop(STEP_ATTACH);
+
+	for(int i=0; i<reads; i++) {
+		if ( cg.memory_peak()<0 ) fail("reading memory.peak", errno);
+		if ( cg.cpu_stat("usage_usec")<0 ) fail("reading cpu.stat", errno);
+	}
+	t.stop(STEP_STATS);
+
+	if ( cg.kill()!=0 ) fail("killing processes", errno);
+	t.stop(STEP_KILL);
+
+	while ( cg.remove()!=0 ) {
+		if ( errno!=EBUSY ) fail("deleting cgroup", errno);
+	}
+	t.stop(STEP_DELETE);
+}
+
+#ifdef HAVE_LIBCGROUP
+void bench_libcgroup(const char *name, int reads, timings &t)
+{
+	int ret;
+
+	t.start();
+	struct cgroup *cg = cgroup_new_cgroup(name);
+	if ( cg==nullptr ) fail("cgroup_new_cgroup", 0);
+	struct cgroup_controller *ctrl = cgroup_add_controller(cg, "memory");
+	if ( ctrl==nullptr ) fail("cgroup_add_controller", 0);
+	if ( (ret = cgroup_add_value_uint64(ctrl, "memory.max", MEMORY_LIMIT))!=0 ||
+	     (ret = cgroup_add_value_uint64(ctrl, "memory.swap.max", 0))!=0 ) {
+		fail("cgroup_add_value_uint64", 0);
+	}
+	if ( (ret = cgroup_create_cgroup(cg, 1))!=0 ) fail(cgroup_strerror(ret), errno);
+	cgroup_free(&cg);
+	t.stop(STEP_CREATE);
+
+	run_child([&]() {
+		const char *controllers[] = { "memory", nullptr };
+		return cgroup_change_cgroup_path(name, getpid(), controllers);
+	});
+	t.stop(STEP_ATTACH);
+
+	for(int i=0; i<reads; i++) {
+		if ( (cg = cgroup_new_cgroup(name))==nullptr ) fail("cgroup_new_cgroup", 0);
+		if ( (ret = cgroup_get_cgroup(cg))!=0 ) fail(cgroup_strerror(ret), errno);
+		int64_t peak;
+		ctrl = cgroup_get_controller(cg, "memory");
+		if ( (ret = cgroup_get_value_int64(ctrl, "memory.peak", &peak))!=0 ) {
+			fail(cgroup_strerror(ret), errno);
+		}
+
+		struct cgroup_stat stat;
+		void *handle;
+		ret = cgroup_read_stats_begin("cpu", name, &handle, &stat);
+		while ( ret==0 ) ret = cgroup_read_stats_next(&handle, &stat);
+		if ( ret!=ECGEOF ) fail(cgroup_strerror(ret), errno);
+		cgroup_read_stats_end(&handle);
+		cgroup_free(&cg);
+	}
+	t.stop(STEP_STATS);
+
+	char controller[] = "memory";
+	int size;
+	do {
+		pid_t *pids;
+		if ( (ret = cgroup_get_procs(const_cast<char *>(name), controller, &pids, &size))!=0 ) {
+			fail(cgroup_strerror(ret), errno);
+		}
+		for(int i=0; i<size; i++) kill(pids[i], SIGKILL);
+		free(pids);
+	} while ( size>0 );
+	t.stop(STEP_KILL);
+
+	if ( (cg = cgroup_new_cgroup(name))==nullptr ) fail("cgroup_new_cgroup", 0);
+	if ( cgroup_add_controller(cg, "memory")==nullptr ) fail("cgroup_add_controller", 0);
+	ret = cgroup_delete_cgroup_ext(cg, CGFLAG_DELETE_IGNORE_MIGRATION | CGFLAG_DELETE_RECURSIVE);
+	if ( ret!=0 ) fail(cgroup_strerror(ret), errno);
+	cgroup_free(&cg);
+	t.stop(STEP_DELETE);
+}
+#endif
+
+void report(const char *impl, const timings &t, int runs)
+{
+	double sum = 0;
+	printf("%-10s", impl);
+	for(int i=0; i<NUM_STEPS; i++) {
+		printf(" %10.1f", t.total[i] / runs);
+		sum += t.total[i];
+	}
+	printf(" %10.1f\n", sum / runs);
+}
+
+int main(int argc, char **argv)
+{
+	int runs = 100, reads = 1, opt;
+	while ( (opt = getopt(argc, argv, "n:s:"))!=-1 ) {
+		switch ( opt ) {
+		case 'n': runs  = atoi(optarg); break;
+		case 's': reads = atoi(optarg); break;
+		default:
+			fprintf(stderr, "Usage: %s [-n RUNS] [-s READS] [PARENT]\n", argv[0]);
+			return 1;
+		}
+	}
+	if ( runs<=0 || reads<0 ) {
+		fprintf(stderr, "bench_cgroup: RUNS must be positive and READS not negative\n");
+		return 1;
+	}
+	const char *parent = optind<argc ? argv[optind] : "domjudge";
+
+#ifdef HAVE_LIBCGROUP
+	int ret = cgroup_init();
+	if ( ret!=0 ) fail(cgroup_strerror(ret), errno);
+#endif
+
+	char name[256];
+	timings native;
+	for(int i=0; i<runs; i++) {
+		snprintf(name, sizeof(name), "%s/bench_%d_%d", parent, (int)getpid(), i);
+		bench_native(name, reads, native);
+	}
+#ifdef HAVE_LIBCGROUP
+	timings libcg;
+	for(int i=0; i<runs; i++) {
+		snprintf(name, sizeof(name), "%s/bench_%d_%d", parent, (int)getpid(), i);
+		bench_libcgroup(name, reads, libcg);
+	}
+#endif
+
+	printf("Mean time per run in microseconds over %d runs, %d stats reads per run:\n", runs, reads);
+	printf("%-10s", "");
+	for(int i=0; i<NUM_STEPS; i++) printf(" %10s", step_names[i]);
+	printf(" %10s\n", "total");
+	report("lib.cgroup", native, runs);
+#ifdef HAVE_LIBCGROUP
+	report("libcgroup", libcg, runs);
+#else
+	printf("libcgroup  not available, build with libcgroup headers and -lcgroup to compare\n");
+#endif
+
+	return 0;
+}
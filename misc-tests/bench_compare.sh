@@ -0,0 +1,221 @@
+#!/bin/bash
+# Benchmark the throughput of compare.cc on generated outputs.
+#
+# Usage: ./bench_compare.sh [-s SIZES] [-k KINDS] [-d DIR] [-r PERCENT] [COMPARE [COMPARE2]]
+#
+# Generates answer and team output pairs of each kind and size (e.g. 1M,
+# 256M, 4G) in DIR, reusing those from earlier runs, and runs COMPARE on
+# them with each option set that they are meant to pass (mismatch_end only
+# fails at its end). Reports the throughput in MB/s of answer file
+# and the peak RSS (if GNU time is installed). COMPARE defaults to compare.cc
+# from this tree, built like the build script does. With COMPARE2, both are
+# run and compared: the script fails if COMPARE2 gives a different result
+# or is more than PERCENT (default 10) percent slower on any output.
+
+set -e
+
+SIZES="1M 16M 256M"
+KINDS="int float longtoken whitespace mixedcase mismatch_end"
+CORPUS_DIR="${TMPDIR:-/tmp}/compare-corpus"
+MAX_SLOWDOWN=10
+OPTION_SETS=("" "case_sensitive" "space_change_sensitive" "float_tolerance 1e-6")
+
+usage() {
+    sed -n '2,/^$/s/^# \?//p' "$0" >&2
+    exit 1
+}
+
+while getopts "s:k:d:r:h" opt; do
+    case $opt in
+        s) SIZES="${OPTARG//,/ }" ;;
+        k) KINDS="${OPTARG//,/ }" ;;
+        d) CORPUS_DIR="$OPTARG" ;;
+        r) MAX_SLOWDOWN="$OPTARG" ;;
+        *) usage ;;
+    esac
+done
+shift $((OPTIND - 1))
+[ $# -le 2 ] || usage
+
+WORK_DIR=$(mktemp -d)
+trap 'rm -rf "$WORK_DIR"' EXIT
+
+if [ $# -eq 0 ]; then
+    echo "Building compare.cc" >&2
+    g++ -std=c++17 -O1 -pthread ../sql/files/defaultdata/compare/compare.cc -o "$WORK_DIR/compare"
+    BINARIES=("$WORK_DIR/compare")
+else
+    BINARIES=("$@")
+fi
+
+if [ -x /usr/bin/time ] && /usr/bin/time -f %M true 2>/dev/null; then
+    TIME=/usr/bin/time
+else
+    TIME=
+    echo "GNU time not found, not measuring peak RSS" >&2
+fi
+
+to_bytes() {
+    local n=${1%[KkMmGg]}
+    case $1 in
+        *[Kk]) echo $((n << 10)) ;;
+        *[Mm]) echo $((n << 20)) ;;
+        *[Gg]) echo $((n << 30)) ;;
+        *) echo "$n" ;;
+    esac
+}
+
+# Write a block of about $3 bytes of answer ($1) and team output ($2) of the
+# given kind. Both contain the same tokens, but the team output is formatted
+# differently, so that compare cannot take the byte-exact fast path.
+gen_block() {
+    awk -v kind="$4" -v size="$3" -v ans="$1" -v team="$2" '
+    function word(len,   s, i) {
+        s = ""
+        for (i = 0; i < len; i++) s = s substr(letters, int(rand() * 52) + 1, 1)
+        return s
+    }
+    BEGIN {
+        srand(42)
+        letters = "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ"
+        split(" \t\n\r", spaces, "")
+        n = 0
+        while (n < size) {
+            if (kind == "int" || kind == "mismatch_end") {
+                t = int(rand() * 2000000000) - 1000000000
+                a = t; b = t
+                sa = (++i % 10 ? " " : "\n"); sb = (kind == "int" ? "  " : sa)
+            } else if (kind == "float") {
+                v = rand() * 2000 - 1000
+                a = sprintf("%.9f", v); b = sprintf("%.12f", v)
+                sa = (++i % 10 ? " " : "\n"); sb = "\n"
+            } else if (kind == "longtoken") {
+                a = word(1000 + int(rand() * 4000)); b = a
+                sa = "\n"; sb = " "
+            } else if (kind == "whitespace") {
+                a = word(1 + int(rand() * 4)); b = a
+                sa = ""
+                for (j = int(rand() * 20); j >= 0; j--) sa = sa spaces[int(rand() * 4) + 1]
+                sb = " "
+            } else if (kind == "mixedcase") {
+                a = word(2 + int(rand() * 10)); b = toupper(a)
+                sa = (++i % 10 ? " " : "\n"); sb = sa
+            }
+            printf "%s%s", a, sa > ans
+            printf "%s%s", b, sb > team
+            n += length(a) + length(sa)
+        }
+    }'
+}
+
+# Generate the answer and team output of the given kind and size, named
+# $CORPUS_DIR/<kind>-<size>.{ans,team}, if they do not exist yet. Larger
+# outputs repeat a block of at most 16 MB.
+gen_corpus() {
+    local kind=$1 size=$2 bytes base ans team
+    bytes=$(to_bytes "$size")
+    base="$CORPUS_DIR/$kind-$size"
+    ans="$base.ans"
+    team="$base.team"
+    [ -f "$ans" ] && [ -f "$team" ] && return
+
+    echo "Generating $kind corpus of $size" >&2
+    mkdir -p "$CORPUS_DIR"
+    local block=$((bytes < (16 << 20) ? bytes : (16 << 20)))
+    gen_block "$WORK_DIR/block.ans" "$WORK_DIR/block.team" "$block" "$kind"
+    : > "$ans.tmp"
+    : > "$team.tmp"
+    local copies
+    for ((copies = 0; copies * block < bytes; copies++)); do
+        cat "$WORK_DIR/block.ans" >> "$ans.tmp"
+        cat "$WORK_DIR/block.team" >> "$team.tmp"
+    done
+    if [ "$kind" = mismatch_end ]; then
+        echo 1 >> "$ans.tmp"
+        echo 2 >> "$team.tmp"
+    fi
+    mv "$ans.tmp" "$ans"
+    mv "$team.tmp" "$team"
+}
+
+# Run compare binary $1 on corpus $2 with options $3. Sets EXIT_CODE, SECS,
+# RSS (in KB) and MESSAGE.
+run_compare() {
+    local compare=$1 base=$2 start end
+    local -a opts
+    read -r -a opts <<< "$3"
+    rm -rf "$WORK_DIR/feedback"
+    mkdir "$WORK_DIR/feedback"
+    EXIT_CODE=0
+    start=$(date +%s%N)
+    if [ -n "$TIME" ]; then
+        $TIME -o "$WORK_DIR/time" -f %M "$compare" /dev/null "$base.ans" "$WORK_DIR/feedback" "${opts[@]}" \
+            < "$base.team" || EXIT_CODE=$?
+        RSS=$(tail -n 1 "$WORK_DIR/time")
+    else
+        "$compare" /dev/null "$base.ans" "$WORK_DIR/feedback" "${opts[@]}" < "$base.team" || EXIT_CODE=$?
+        RSS=-
+    fi
+    end=$(date +%s%N)
+    SECS=$(awk -v ns=$((end - start)) 'BEGIN { printf "%.3f", ns / 1e9 }')
+    MESSAGE=$(cat "$WORK_DIR/feedback/judgemessage.txt" "$WORK_DIR/feedback/diffposition.txt" 2>/dev/null || true)
+}
+
+# Whether to run compare on outputs of kind $1 with options $2. The team
+# output of some kinds differs from the answer in ways that other options
+# reject at the first token, which would not measure anything.
+runs_with() {
+    case "$1:$2" in
+        float:|float:case_sensitive|float:space_change_sensitive) return 1 ;;
+        int:space_change_sensitive|longtoken:space_change_sensitive) return 1 ;;
+        whitespace:space_change_sensitive|mixedcase:case_sensitive) return 1 ;;
+    esac
+    return 0
+}
+
+mbps() {
+    awk -v bytes="$1" -v secs="$2" 'BEGIN { printf "%.1f", (secs > 0 ? bytes / secs / 1048576 : 0) }'
+}
+
+failed=0
+if [ ${#BINARIES[@]} -eq 1 ]; then
+    printf "%-13s %6s %-25s %5s %10s %10s\n" kind size options exit MB/s "RSS (KB)"
+else
+    printf "%-13s %6s %-25s %5s %10s %10s %10s %10s\n" kind size options exit MB/s "RSS (KB)" MB/s2 "RSS2 (KB)"
+fi
+
+for size in $SIZES; do
+    for kind in $KINDS; do
+        gen_corpus "$kind" "$size"
+        base="$CORPUS_DIR/$kind-$size"
+        bytes=$(stat -c %s "$base.ans")
+        for opts in "${OPTION_SETS[@]}"; do
+            runs_with "$kind" "$opts" || continue
+            run_compare "${BINARIES[0]}" "$base" "$opts"
+            line=$(printf "%-13s %6s %-25s %5s %10s %10s" "$kind" "$size" "${opts:-default}" \
+                   "$EXIT_CODE" "$(mbps "$bytes" "$SECS")" "$RSS")
+            expected=42
+            [ "$kind" = mismatch_end ] && expected=43
+            if [ "$EXIT_CODE" != "$expected" ]; then
+                line+="  UNEXPECTED RESULT"
+                failed=1
+            fi
+            if [ ${#BINARIES[@]} -eq 2 ]; then
+                exit1=$EXIT_CODE secs1=$SECS message1=$MESSAGE
+                run_compare "${BINARIES[1]}" "$base" "$opts"
+                line+=$(printf " %10s %10s" "$(mbps "$bytes" "$SECS")" "$RSS")
+                if [ "$EXIT_CODE" != "$exit1" ] || [ "$MESSAGE" != "$message1" ]; then
+                    line+="  DIFFERENT RESULT"
+                    failed=1
+                elif awk -v a="$secs1" -v b="$SECS" -v pct="$MAX_SLOWDOWN" \
+                        'BEGIN { exit !(b > a * (1 + pct / 100) && b - a > 0.05) }'; then
+                    line+="  SLOWER"
+                    failed=1
+                fi
+            fi
+            echo "$line"
+        done
+    done
+done
+
+exit $failed
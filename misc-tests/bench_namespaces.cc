@@ -0,0 +1,155 @@
+/*
+ * Benchmark joining pinned network and UTS namespaces, as runguard does with
+ * its --namespaces option, against creating new ones for every run.
+ *
+ * Build from this directory with:
+ *
+ *   g++ -std=c++20 -O2 bench_namespaces.cc -o bench_namespaces
+ *
+ * and run as root:
+ *
+ *   ./bench_namespaces [-n RUNS] [-c CONCURRENCY]
+ *
+ * Starts CONCURRENCY (default 1) workers, like as many judgedaemons on one
+ * host, that each do RUNS (default 100) runs one after another. A run forks
+ * a child that gets its namespaces like runguard does and exits right away.
+ * In the pinned mode, each worker first creates its own network and UTS
+ * namespaces that its children join; new IPC and mount namespaces are
+ * created in both modes. Reports the latency of a run and the total number
+ * of runs per second over all workers.
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <getopt.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <vector>
+
+using bench_clock = std::chrono::steady_clock;
+
+enum { MODE_PINNED, MODE_NEW, NUM_MODES };
+const char *mode_names[NUM_MODES] = { "pinned", "new" };
+
+[[noreturn]] void fail(const char *what, int errnum)
+{
+	fprintf(stderr, "bench_namespaces: %s: %s\n", what, strerror(errnum));
+	exit(1);
+}
+
+int open_ns(const char *name)
+{
+	char path[64];
+	snprintf(path, sizeof(path), "/proc/self/ns/%s", name);
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+	if ( fd<0 ) fail(path, errno);
+	return fd;
+}
+
+/* Do 'runs' runs and store their latencies in microseconds in 'latency'. */
+void worker(int mode, int runs, double *latency)
+{
+	int netfd = -1, utsfd = -1;
+	if ( mode==MODE_PINNED ) {
+		int hostnet = open_ns("net"), hostuts = open_ns("uts");
+		if ( unshare(CLONE_NEWNET | CLONE_NEWUTS)!=0 ) fail("unshare", errno);
+		netfd = open_ns("net");
+		utsfd = open_ns("uts");
+		if ( setns(hostnet, CLONE_NEWNET)!=0 || setns(hostuts, CLONE_NEWUTS)!=0 ) {
+			fail("returning to host namespaces", errno);
+		}
+		close(hostnet);
+		close(hostuts);
+	}
+
+	for(int i=0; i<runs; i++) {
+		auto start = bench_clock::now();
+		pid_t pid = fork();
+		if ( pid<0 ) fail("fork", errno);
+		if ( pid==0 ) {
+			int flags = CLONE_NEWIPC | CLONE_NEWNS;
+			if ( mode==MODE_PINNED ) {
+				if ( setns(netfd, CLONE_NEWNET)!=0 || setns(utsfd, CLONE_NEWUTS)!=0 ) _exit(1);
+			} else {
+				flags |= CLONE_NEWNET | CLONE_NEWUTS;
+			}
+			_exit(unshare(flags)!=0 ? 1 : 0);
+		}
+
+		int status;
+		if ( waitpid(pid, &status, 0)<0 ) fail("waitpid", errno);
+		if ( !WIFEXITED(status) || WEXITSTATUS(status)!=0 ) {
+			fprintf(stderr, "bench_namespaces: getting namespaces failed in child\n");
+			exit(1);
+		}
+		latency[i] = std::chrono::duration<double, std::micro>(bench_clock::now() - start).count();
+	}
+}
+
+void bench(int mode, int runs, int concurrency)
+{
+	size_t total = (size_t)runs * concurrency;
+	/* Shared with the workers, which write their latencies into it. */
+	void *mem = mmap(nullptr, total * sizeof(double), PROT_READ | PROT_WRITE,
+	                 MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if ( mem==MAP_FAILED ) fail("mmap", errno);
+	double *latency = static_cast<double *>(mem);
+
+	auto start = bench_clock::now();
+	for(int w=0; w<concurrency; w++) {
+		pid_t pid = fork();
+		if ( pid<0 ) fail("fork", errno);
+		if ( pid==0 ) {
+			worker(mode, runs, latency + (size_t)w * runs);
+			_exit(0);
+		}
+	}
+	for(int w=0; w<concurrency; w++) {
+		int status;
+		if ( wait(&status)<0 ) fail("wait", errno);
+		if ( !WIFEXITED(status) || WEXITSTATUS(status)!=0 ) exit(1);
+	}
+	double secs = std::chrono::duration<double>(bench_clock::now() - start).count();
+
+	std::vector<double> sorted(latency, latency + total);
+	std::sort(sorted.begin(), sorted.end());
+	double sum = 0;
+	for(double l : sorted) sum += l;
+	printf("%-8s %10.1f %10.1f %10.1f %10.1f %10.1f\n", mode_names[mode], sum / total,
+	       sorted[total / 2], sorted[total * 99 / 100], sorted[total - 1], total / secs);
+
+	munmap(mem, total * sizeof(double));
+}
+
+int main(int argc, char **argv)
+{
+	int runs = 100, concurrency = 1, opt;
+	while ( (opt = getopt(argc, argv, "n:c:"))!=-1 ) {
+		switch ( opt ) {
+		case 'n': runs        = atoi(optarg); break;
+		case 'c': concurrency = atoi(optarg); break;
+		default:
+			fprintf(stderr, "Usage: %s [-n RUNS] [-c CONCURRENCY]\n", argv[0]);
+			return 1;
+		}
+	}
+	if ( runs<=0 || concurrency<=0 ) {
+		fprintf(stderr, "bench_namespaces: RUNS and CONCURRENCY must be positive\n");
+		return 1;
+	}
+
+	printf("Latency per run in microseconds over %d runs by each of %d workers:\n", runs, concurrency);
+	printf("%-8s %10s %10s %10s %10s %10s\n", "", "mean", "median", "99%", "max", "runs/s");
+	/* Run the pinned mode first: the kernel cleans up network namespaces
+	 * in the background, which would slow down whatever runs after. */
+	for(int mode=0; mode<NUM_MODES; mode++) bench(mode, runs, concurrency);
+
+	return 0;
+}
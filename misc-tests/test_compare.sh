@@ -27,6 +27,16 @@ exec_compare() {
     mkdir -p feedback
     shift 2
 
+    # Optionally provide an answer index, built from $INDEX_OF if set
+    if [ -n "$WITH_INDEX" ]; then
+        if [ -n "${INDEX_OF+set}" ]; then
+            echo "$INDEX_OF" > index_of.txt
+        else
+            cp judge_ans.txt index_of.txt
+        fi
+        $COMPARE_EXECUTABLE --build-index index_of.txt > judge_ans.txt.idx
+    fi
+
     # Run the compare program
     EXIT_CODE=0
     $COMPARE_EXECUTABLE judge_in.txt judge_ans.txt feedback "$@" < team_out.txt || EXIT_CODE=$?
@@ -41,8 +51,14 @@ exec_compare() {
         fi
     fi
 
+    # Optionally check the mismatch context for a fragment $EXPECT_CONTEXT
+    if [ -n "$EXPECT_CONTEXT" ] && ! grep -qF "$EXPECT_CONTEXT" feedback/diffcontext.json; then
+        fail "$test_name: expected '$EXPECT_CONTEXT' in diffcontext.json"
+        cat feedback/diffcontext.json >&2
+    fi
+
     # Clean up
-    rm -rf judge_in.txt judge_ans.txt team_out.txt feedback
+    rm -rf judge_in.txt judge_ans.txt judge_ans.txt.idx index_of.txt team_out.txt feedback
 }
 
 test_identical_files() {
@@ -53,6 +69,14 @@ test_different_files() {
     exec_compare 43 "Different files" "hello world" "hello there"
 }
 
+test_identical_prefix_then_longer_token() {
+    exec_compare 43 "Identical prefix, then a longer token" "hello world" "hello worlds"
+}
+
+test_identical_prefix_then_case_change() {
+    exec_compare 42 "Identical prefix, then a case change" $'a\nb\nCD' $'a\nb\ncd'
+}
+
 test_float_within_tolerance() {
     exec_compare 42 "Float comparison, within tolerance" "1.000000000" "1.000000001" float_tolerance 1.1e-9
 }
@@ -61,6 +85,10 @@ test_float_outside_tolerance() {
     exec_compare 43 "Float comparison, outside tolerance" "1.000" "1.001" float_tolerance 1e-4
 }
 
+test_float_notations() {
+    exec_compare 42 "Float comparison, different notations" "+1e3 -0.5 inf" "1000.0000001 -5E-1 INF" float_tolerance 1e-9
+}
+
 test_invalid_float() {
     exec_compare 43 "Invalid float (should fail with current isfloat)" "1.0" "1.0a" float_tolerance 1e-9
 }
@@ -85,10 +113,52 @@ test_invalid_float_extra_chars() {
     exec_compare 43 "Invalid float with extra characters" "1.0" "1.0abc" float_tolerance 1e-9
 }
 
+test_answer_index() {
+    WITH_INDEX=1 exec_compare 42 "Answer index, case change after identical prefix" $'a\nb\nCD' $'a\nb\ncd'
+    WITH_INDEX=1 exec_compare 43 "Answer index, trailing output" "1 2 3" "1 2 3 4"
+    WITH_INDEX=1 exec_compare 42 "Answer index, float within tolerance" "x 1.000000000" "x 1.000000001" float_tolerance 1.1e-9
+    WITH_INDEX=1 exec_compare 43 "Answer index, float outside tolerance" "x 1.000" "x 1.001" float_tolerance 1e-4
+    WITH_INDEX=1 INDEX_OF="1 3 4" exec_compare 42 "Answer index of another answer is ignored" "1 2" "1 2"
+    WITH_INDEX=1 INDEX_OF="a bc" exec_compare 42 "Answer index of another answer of the same size is ignored" "ab c" "AB c"
+}
+
+test_parallel() {
+    # Compare even tiny outputs in parallel, on more threads than there are chunks.
+    local COMPARE_EXECUTABLE=./compare_parallel_executable
+    g++ -g -O2 -Wall -std=c++20 -pthread -DPARALLEL_MIN_SIZE=1 -DPARALLEL_THREADS=4 \
+        ../sql/files/defaultdata/compare/compare.cc -o $COMPARE_EXECUTABLE
+    exec_compare 42 "Parallel comparison, case change" $'A b\nc d e f g' $'a b\nc d E f g'
+    exec_compare 43 "Parallel comparison, mismatch" $'A b\nc d e f g' $'a b\nc d e f h'
+    exec_compare 43 "Parallel comparison, trailing output" $'A b\nc d e f g' $'a b\nc d e f g h'
+    exec_compare 43 "Parallel comparison, missing output" $'A b\nc d e f g' $'a b\nc d e f'
+    exec_compare 42 "Parallel comparison, floats" $'A 1.0 2.0 3.0 4.0' $'a 1 2.0000001 3 4' float_tolerance 1e-6
+    rm -f $COMPARE_EXECUTABLE
+}
+
+test_mismatch_context() {
+    EXPECT_CONTEXT='"team": {"line": 3, "column": 3, "offset": 10, "context": [{"line": 1, "column": 1, "text": "a b"}, {"line": 2, "column": 1, "text": "c d"}, {"line": 3, "column": 1, "text": "e F"}, {"line": 4, "column": 1, "text": "g h"}]}' \
+        exec_compare 43 "Mismatch context" $'a b\nc d\ne f\ng h' $'a b\nc d\ne F\ng h' case_sensitive
+    EXPECT_CONTEXT='"judge": {"line": 1, "column": 3, "offset": 2, "context": [{"line": 1, "column": 1, "text": "1\u00092\u00ff"}]}' \
+        exec_compare 43 "Mismatch context, escaped" $'1\t2\xff' $'1\t3'
+    WITH_INDEX=1 EXPECT_CONTEXT='"judge": {"line": 2, "column": 1, "offset": 4, "context": [{"line": 1, "column": 1, "text": "x y"}, {"line": 2, "column": 1, "text": "z"}]}' \
+        exec_compare 43 "Mismatch context, answer index" $'x y\nz' $'x y\nw'
+}
+
+test_selftest() {
+    echo -n "- Scan kernels and float parsing behave like the C library "
+    if g++ -g -O2 -Wall -std=c++20 -pthread -DCOMPARE_SELFTEST ../sql/files/defaultdata/compare/compare.cc -o compare_selftest \
+            && ./compare_selftest > /dev/null; then
+        echo -e "\e[32m✔\e[0m" >&2
+    else
+        fail "self-test of compare failed"
+    fi
+    rm -f compare_selftest
+}
+
 
 any_test_failed=0
 
-g++ -g -O2 -Wall -std=c++20 ../sql/files/defaultdata/compare/compare.cc -o $COMPARE_EXECUTABLE
+g++ -g -O2 -Wall -std=c++20 -pthread ../sql/files/defaultdata/compare/compare.cc -o $COMPARE_EXECUTABLE
 
 for func in $(compgen -o nosort -A function test_); do
     fail=0
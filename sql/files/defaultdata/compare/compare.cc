@@ -1,10 +1,13 @@
 // default_validator from kattis problemtools package
 // licensed under MIT license
 //
-// modified: float comparison
+// modified: float comparison, memory-mapped input, vectorized scanning,
+//           fast float parsing, byte-exact fast path, answer index,
+//           specialized comparison loops, mismatch context
 #include <fstream>
-#include <iostream>
 #include <string>
+#include <vector>
+#include <algorithm>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
@@ -12,32 +15,98 @@
 #include <cmath>
 #include <cstdarg>
 #include <cctype>
+#include <cerrno>
+#include <cfloat>
+#include <cstdint>
+#include <charconv>
+#include <atomic>
+#include <thread>
+#include <system_error>
+#include <sched.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_X86_KERNELS 1
+#endif
 
 const int EXIT_AC = 42;
 const int EXIT_WA = 43;
 
-std::ifstream judgein, judgeans;
+std::ifstream judgein;
 FILE *judgemessage = NULL;
 FILE *diffpos = NULL;
-int judgeans_pos, stdin_pos;
-int judgeans_line, stdin_line;
+FILE *diffcontext = NULL;
+// Thread-local for the parallel comparison, see compare_parallel().
+thread_local long long judgeans_pos, stdin_pos;
+thread_local long long judgeans_line, stdin_line;
 
 /* The floating point type we use internally: */
 typedef long double flt;
 
-void wrong_answer(const char *err, ...) {
+/* A wrong answer found by a thread of the parallel comparison. */
+struct mismatch {
+	std::string message, position, context;
+};
+
+class input_stream;
+
+/* The inputs being compared, for the context of a mismatch. Set by
+ * compare_tokens(), per thread for the parallel comparison.
+ */
+thread_local const input_stream *context_ans = NULL, *context_team = NULL;
+
+std::string mismatch_context();
+
+/* Set in the threads of the parallel comparison, where wrong_answer() throws
+ * its report instead of writing it and exiting.
+ */
+thread_local bool throw_mismatch = false;
+
+std::string vformat(const char *fmt, va_list pvar) {
+	va_list copy;
+	va_copy(copy, pvar);
+	int len = vsnprintf(NULL, 0, fmt, copy);
+	va_end(copy);
+	std::string res(len > 0 ? len : 0, '\0');
+	if (len > 0) vsnprintf(&res[0], len + 1, fmt, pvar);
+	return res;
+}
+
+std::string format(const char *fmt, ...) {
 	va_list pvar;
-	va_start(pvar, err);
-	fprintf(judgemessage, "Wrong answer on line %d of output (corresponding to line %d in answer file)\n",
-			stdin_line, judgeans_line);
-	vfprintf(judgemessage, err, pvar);
-	fprintf(judgemessage, "\n");
+	va_start(pvar, fmt);
+	std::string res = vformat(fmt, pvar);
+	va_end(pvar);
+	return res;
+}
+
+void report_wrong_answer(const mismatch &m) {
+	fputs(m.message.c_str(), judgemessage);
 	if (diffpos) {
-		fprintf(diffpos, "%d %d", judgeans_pos, stdin_pos);
+		fputs(m.position.c_str(), diffpos);
+	}
+	if (diffcontext) {
+		fputs(m.context.c_str(), diffcontext);
 	}
 	exit(EXIT_WA);
 }
 
+void wrong_answer(const char *err, ...) {
+	va_list pvar;
+	va_start(pvar, err);
+	mismatch m;
+	m.message = format("Wrong answer on line %lld of output (corresponding to line %lld in answer file)\n",
+	                   stdin_line, judgeans_line) + vformat(err, pvar) + "\n";
+	va_end(pvar);
+	m.position = format("%lld %lld", judgeans_pos, stdin_pos);
+	m.context = mismatch_context();
+	if (throw_mismatch) throw m;
+	report_wrong_answer(m);
+}
+
 void judge_error(const char *err, ...) {
 	va_list pvar;
 	va_start(pvar, err);
@@ -48,6 +117,495 @@ void judge_error(const char *err, ...) {
 	assert(!"Judge Error");
 }
 
+/* The characters std::isspace() considers whitespace in the C locale. */
+inline bool is_space(char c) {
+	return c == ' ' || (c >= '\t' && c <= '\r');
+}
+
+/* The characters std::isprint() considers printable in the C locale. */
+inline bool is_print(char c) {
+	return c >= 0x20 && c <= 0x7e;
+}
+
+/* std::tolower() in the C locale. */
+inline char to_lower_ascii(char c) {
+	return (c >= 'A' && c <= 'Z') ? c + ('a' - 'A') : c;
+}
+
+/* Kernels for scanning the input, which is where compare spends most of its
+ * time on large outputs. Besides the scalar versions there are SSE2 and AVX2
+ * versions; the best one the CPU supports is selected at startup.
+ */
+struct scan_kernels {
+	const char *name;
+	// Index of the first whitespace character, or n if there is none.
+	size_t (*find_space)(const char *s, size_t n);
+	// Index of the first non-whitespace character, or n if there is none.
+	size_t (*find_nonspace)(const char *s, size_t n);
+	size_t (*count_newlines)(const char *s, size_t n);
+	bool (*all_printable)(const char *s, size_t n);
+	// Whether a and b are equal when ignoring ASCII case.
+	bool (*equal_nocase)(const char *a, const char *b, size_t n);
+};
+
+size_t find_space_scalar(const char *s, size_t n) {
+	size_t i = 0;
+	while (i < n && !is_space(s[i])) i++;
+	return i;
+}
+
+size_t find_nonspace_scalar(const char *s, size_t n) {
+	size_t i = 0;
+	while (i < n && is_space(s[i])) i++;
+	return i;
+}
+
+size_t count_newlines_scalar(const char *s, size_t n) {
+	size_t res = 0;
+	for (size_t i = 0; i < n; i++) res += s[i] == '\n';
+	return res;
+}
+
+bool all_printable_scalar(const char *s, size_t n) {
+	for (size_t i = 0; i < n; i++) {
+		if (!is_print(s[i])) return false;
+	}
+	return true;
+}
+
+bool equal_nocase_scalar(const char *a, const char *b, size_t n) {
+	for (size_t i = 0; i < n; i++) {
+		if (to_lower_ascii(a[i]) != to_lower_ascii(b[i])) return false;
+	}
+	return true;
+}
+
+const scan_kernels kernels_scalar = {
+	"scalar", find_space_scalar, find_nonspace_scalar, count_newlines_scalar,
+	all_printable_scalar, equal_nocase_scalar
+};
+
+#ifdef HAVE_X86_KERNELS
+/* Byte ranges are checked with signed comparisons: c is in [lo, lo+len) iff
+ * (c - lo) ^ 0x80 < len ^ 0x80 as signed bytes.
+ */
+#define DEFINE_X86_KERNELS(suffix, isa, vec, width, pre)                                \
+	__attribute__((target(isa))) inline vec                                         \
+	in_range_##suffix(vec c, char lo, char len) {                                   \
+		vec t = pre##_xor_si##width(pre##_sub_epi8(c, pre##_set1_epi8(lo)),     \
+		                            pre##_set1_epi8((char)0x80));               \
+		return pre##_cmpgt_epi8(pre##_set1_epi8((char)(len ^ 0x80)), t);        \
+	}                                                                               \
+	__attribute__((target(isa))) inline vec space_mask_##suffix(vec c) {            \
+		return pre##_or_si##width(pre##_cmpeq_epi8(c, pre##_set1_epi8(' ')),    \
+		                          in_range_##suffix(c, '\t', 5));               \
+	}                                                                               \
+	__attribute__((target(isa))) inline vec to_lower_##suffix(vec c) {              \
+		return pre##_add_epi8(c, pre##_and_si##width(                           \
+			in_range_##suffix(c, 'A', 26), pre##_set1_epi8('a' - 'A')));    \
+	}                                                                               \
+	__attribute__((target(isa))) size_t                                             \
+	find_space_##suffix(const char *s, size_t n) {                                  \
+		const size_t W = sizeof(vec);                                           \
+		size_t i = 0;                                                           \
+		for (; i + W <= n; i += W) {                                            \
+			vec c = pre##_loadu_si##width((const vec *)(s + i));            \
+			unsigned mask = pre##_movemask_epi8(space_mask_##suffix(c));    \
+			if (mask) return i + __builtin_ctz(mask);                       \
+		}                                                                       \
+		return i + find_space_scalar(s + i, n - i);                             \
+	}                                                                               \
+	__attribute__((target(isa))) size_t                                             \
+	find_nonspace_##suffix(const char *s, size_t n) {                               \
+		const size_t W = sizeof(vec);                                           \
+		const unsigned ALL = (unsigned)((1ULL << W) - 1);                       \
+		size_t i = 0;                                                           \
+		for (; i + W <= n; i += W) {                                            \
+			vec c = pre##_loadu_si##width((const vec *)(s + i));            \
+			unsigned mask = ~pre##_movemask_epi8(space_mask_##suffix(c)) & ALL; \
+			if (mask) return i + __builtin_ctz(mask);                       \
+		}                                                                       \
+		return i + find_nonspace_scalar(s + i, n - i);                          \
+	}                                                                               \
+	__attribute__((target(isa))) size_t                                             \
+	count_newlines_##suffix(const char *s, size_t n) {                              \
+		const size_t W = sizeof(vec);                                           \
+		size_t i = 0, res = 0;                                                  \
+		for (; i + W <= n; i += W) {                                            \
+			vec c = pre##_loadu_si##width((const vec *)(s + i));            \
+			unsigned mask = pre##_movemask_epi8(                            \
+				pre##_cmpeq_epi8(c, pre##_set1_epi8('\n')));            \
+			res += __builtin_popcount(mask);                                \
+		}                                                                       \
+		return res + count_newlines_scalar(s + i, n - i);                       \
+	}                                                                               \
+	__attribute__((target(isa))) bool                                               \
+	all_printable_##suffix(const char *s, size_t n) {                               \
+		const size_t W = sizeof(vec);                                           \
+		const unsigned ALL = (unsigned)((1ULL << W) - 1);                       \
+		size_t i = 0;                                                           \
+		for (; i + W <= n; i += W) {                                            \
+			vec c = pre##_loadu_si##width((const vec *)(s + i));            \
+			unsigned mask = pre##_movemask_epi8(in_range_##suffix(c, 0x20, 0x5f)); \
+			if (mask != ALL) return false;                                  \
+		}                                                                       \
+		return all_printable_scalar(s + i, n - i);                              \
+	}                                                                               \
+	__attribute__((target(isa))) bool                                               \
+	equal_nocase_##suffix(const char *a, const char *b, size_t n) {                 \
+		const size_t W = sizeof(vec);                                           \
+		const unsigned ALL = (unsigned)((1ULL << W) - 1);                       \
+		size_t i = 0;                                                           \
+		for (; i + W <= n; i += W) {                                            \
+			vec ca = to_lower_##suffix(pre##_loadu_si##width((const vec *)(a + i))); \
+			vec cb = to_lower_##suffix(pre##_loadu_si##width((const vec *)(b + i))); \
+			unsigned mask = pre##_movemask_epi8(pre##_cmpeq_epi8(ca, cb));  \
+			if (mask != ALL) return false;                                  \
+		}                                                                       \
+		return equal_nocase_scalar(a + i, b + i, n - i);                        \
+	}                                                                               \
+	const scan_kernels kernels_##suffix = {                                         \
+		#suffix, find_space_##suffix, find_nonspace_##suffix,                   \
+		count_newlines_##suffix, all_printable_##suffix, equal_nocase_##suffix  \
+	};
+
+DEFINE_X86_KERNELS(sse2, "sse2", __m128i, 128, _mm)
+DEFINE_X86_KERNELS(avx2, "avx2", __m256i, 256, _mm256)
+#undef DEFINE_X86_KERNELS
+#endif
+
+/* Return the fastest kernels that the CPU supports. */
+const scan_kernels *select_kernels() {
+#ifdef HAVE_X86_KERNELS
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2")) return &kernels_avx2;
+	if (__builtin_cpu_supports("sse2")) return &kernels_sse2;
+#endif
+	return &kernels_scalar;
+}
+
+const scan_kernels *kernels = select_kernels();
+
+/* A token as a view into the buffer of an input_stream. */
+struct token_view {
+	const char *data;
+	size_t len;
+
+	std::string str() const { return std::string(data, len); }
+};
+
+/* Input that is memory-mapped if it is a regular file, and otherwise read in
+ * large blocks. This replaces iostreams, which are far too slow for outputs of
+ * hundreds of MB. Tokens are returned as views into the input, which stay
+ * valid until the next token is read from the same stream. Input that is read
+ * keeps the last CONTEXT_KEEP bytes before the current position in memory,
+ * for the context of a mismatch.
+ */
+class input_stream {
+public:
+	input_stream(): data(NULL), pos(0), end(0), fd(-1), map_len(0), base(0), range_limit(0) {}
+
+	~input_stream() {
+		if (map_len > 0) munmap(const_cast<char *>(data), map_len);
+	}
+
+	/* Use the file descriptor as input. Returns false on failure. */
+	bool open_fd(int fd_) {
+		struct stat st;
+		if (fstat(fd_, &st) != 0) return false;
+		off_t offset = lseek(fd_, 0, SEEK_CUR);
+		if (S_ISREG(st.st_mode) && offset >= 0 && st.st_size > 0) {
+			void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd_, 0);
+			if (map != MAP_FAILED) {
+				madvise(map, st.st_size, MADV_SEQUENTIAL);
+				data = static_cast<const char *>(map);
+				map_len = st.st_size;
+				pos = offset < st.st_size ? offset : st.st_size;
+				end = st.st_size;
+				return true;
+			}
+		}
+		if (S_ISREG(st.st_mode) && st.st_size == 0) return true;
+		fd = fd_;
+		buffer.resize(BLOCK_SIZE);
+		data = &buffer[0];
+		return true;
+	}
+
+	/* Use the bytes from 'begin' to 'end_' of the mapped input 'in' as
+	 * input, without copying them. The rest of 'in' is still available
+	 * as context.
+	 */
+	void open_range(const input_stream &in, size_t begin, size_t end_) {
+		data = in.data;
+		pos = begin;
+		end = end_;
+		range_limit = in.end;
+	}
+
+	bool open(const char *file) {
+		int fd_ = ::open(file, O_RDONLY);
+		if (fd_ < 0) return false;
+		bool res = open_fd(fd_);
+		// The mapping stays valid after closing the file.
+		if (fd != fd_) close(fd_);
+		return res;
+	}
+
+	/* Return the next character without consuming it, or EOF. */
+	int peek() {
+		if (pos == end && !fill()) return EOF;
+		return static_cast<unsigned char>(data[pos]);
+	}
+
+	int get() {
+		int c = peek();
+		if (c != EOF) ++pos;
+		return c;
+	}
+
+	/* Read the run of non-whitespace characters at the current position,
+	 * like operator>> on a stream positioned at a non-whitespace character.
+	 * Returns false if there is no such token.
+	 */
+	bool read_token(token_view &tok) {
+		size_t len = 0;
+		while (true) {
+			len += kernels->find_space(data + pos + len, end - pos - len);
+			if (pos + len < end || !fill()) break;
+		}
+		tok.data = data + pos;
+		tok.len = len;
+		pos += len;
+		return len > 0;
+	}
+
+	/* Skip whitespace, adding the number of characters and newlines skipped
+	 * to the counters.
+	 */
+	void skip_space(long long &nchars, long long &nlines) {
+		while (true) {
+			size_t n = kernels->find_nonspace(data + pos, end - pos);
+			nlines += kernels->count_newlines(data + pos, n);
+			nchars += n;
+			pos += n;
+			if (pos < end || !fill()) break;
+		}
+	}
+
+	/* Make at least 'want' bytes available from the current position, unless
+	 * the input ends before. Returns the number of bytes available.
+	 */
+	size_t fill_window(size_t want) {
+		while (end - pos < want && fill()) {}
+		return end - pos;
+	}
+
+	const char *current() const { return data + pos; }
+
+	void advance(size_t n) { pos += n; }
+
+	/* Whether all input has been read into the buffer, or is mapped. */
+	bool all_read() const { return fd < 0; }
+
+	/* For mapped input, the start of the mapping and its length. The
+	 * current position is then the offset in the file.
+	 */
+	bool mapped() const { return map_len > 0; }
+	const char *map_data() const { return data; }
+	size_t size() const { return map_len; }
+	size_t offset() const { return pos; }
+
+	/* The part of the input that is in memory: 'len' bytes from position
+	 * 'first' in the input onward are at the returned pointer.
+	 */
+	const char *memory(size_t &first, size_t &len) const {
+		first = base;
+		len = std::max(end, range_limit);
+		return data;
+	}
+
+private:
+	static const size_t BLOCK_SIZE = 1 << 20;
+	static const size_t CONTEXT_KEEP = 1 << 12;
+
+	/* Read more data into the buffer, keeping the unconsumed data from the
+	 * current position onward. Returns false at EOF.
+	 */
+	bool fill() {
+		if (fd < 0) return false;
+		if (pos > CONTEXT_KEEP) {
+			size_t drop = pos - CONTEXT_KEEP;
+			memmove(&buffer[0], &buffer[drop], end - drop);
+			end -= drop;
+			pos -= drop;
+			base += drop;
+		}
+		if (end == buffer.size()) buffer.resize(2 * buffer.size());
+		data = &buffer[0];
+		ssize_t nread;
+		do {
+			nread = read(fd, &buffer[end], buffer.size() - end);
+		} while (nread < 0 && errno == EINTR);
+		if (nread < 0) judge_error("failed to read input: %s", strerror(errno));
+		if (nread == 0) {
+			fd = -1;
+			return false;
+		}
+		end += nread;
+		return true;
+	}
+
+	const char *data;
+	size_t pos, end;
+	int fd;          // File descriptor to read from, or -1 if at EOF or mapped.
+	size_t map_len;  // Length of the mapping, or 0 if not mapped.
+	size_t base;     // Position in the input of data[0].
+	size_t range_limit;  // For open_range(), the end of the mapping.
+	std::vector<char> buffer;
+};
+
+input_stream judgeans, team_out;
+
+/* On a mismatch, the lines around it in both inputs are written to
+ * 'diffcontext.json' in the feedback directory, so that showing it does not
+ * require reading the (possibly huge) outputs again. Only what is still in
+ * memory is used: all of mapped input, and the last few KB of read input.
+ */
+const int CONTEXT_LINES = 3;           // Shown before and after the mismatch.
+const size_t CONTEXT_WIDTH = 200;      // Bytes shown of a line at most.
+const size_t CONTEXT_SCAN = 1 << 16;   // Bytes searched for a line end at most.
+
+std::string json_string(const char *s, size_t n) {
+	std::string res = "\"";
+	for (size_t i = 0; i < n; i++) {
+		unsigned char c = s[i];
+		if (c == '"' || c == '\\') {
+			res += '\\';
+			res += c;
+		} else if (c < 0x20 || c >= 0x7f) {
+			// Bytes that are not printable ASCII are shown as Latin-1,
+			// so that the result is valid JSON for any output.
+			res += format("\\u%04x", c);
+		} else {
+			res += c;
+		}
+	}
+	return res + "\"";
+}
+
+/* The context of position 'offset' on line 'line' of 'in' as a JSON object
+ * with the line, the column (null if the start of the line is not in memory
+ * or more than CONTEXT_SCAN bytes back), the offset and the lines around it.
+ * Each line has the column of its first byte shown, and is cut to
+ * CONTEXT_WIDTH bytes around the mismatch.
+ */
+std::string stream_context(const input_stream *in, long long offset, long long line) {
+	if (!in) return "null";
+	size_t first, n;
+	const char *data = in->memory(first, n);
+	size_t i = std::min<size_t>(std::max<long long>(offset - (long long)first, 0), n);
+
+	// The start of the line with index 'k', and whether it really is one.
+	auto line_start = [&](size_t k, bool &known) {
+		size_t floor = k > CONTEXT_SCAN ? k - CONTEXT_SCAN : 0;
+		const void *nl = memrchr(data + floor, '\n', k - floor);
+		known = nl || (floor == 0 && first == 0);
+		return nl ? static_cast<const char *>(nl) - data + 1 : floor;
+	};
+	auto line_end = [&](size_t k) {
+		size_t ceil = std::min(n, k + CONTEXT_SCAN);
+		const void *nl = memchr(data + k, '\n', ceil - k);
+		return nl ? static_cast<const char *>(nl) - data : ceil;
+	};
+	std::vector<std::string> lines;
+	auto add_line = [&](long long nr, bool known, size_t start, size_t from, size_t to) {
+		std::string column = known ? format("%zu", from - start + 1) : "null";
+		lines.push_back(format("{\"line\": %lld, \"column\": %s, \"text\": ", nr, column.c_str()) +
+		                json_string(data + from, std::min(to - from, CONTEXT_WIDTH)) + "}");
+	};
+
+	bool known, before_known;
+	size_t start = line_start(i, known), end = line_end(i);
+	size_t from = i - start > CONTEXT_WIDTH / 2 ? i - CONTEXT_WIDTH / 2 : start;
+	size_t s = start;
+	before_known = known;
+	for (int l = 1; l <= CONTEXT_LINES && before_known && s > 0; l++) {
+		size_t e = s - 1;
+		s = line_start(e, before_known);
+		if (!before_known) break;
+		add_line(line - l, true, s, s, e);
+	}
+	std::reverse(lines.begin(), lines.end());
+	add_line(line, known, start, from, end);
+	for (int l = 1; l <= CONTEXT_LINES && end + 1 < n; l++) {
+		s = end + 1;
+		end = line_end(s);
+		add_line(line + l, true, s, s, end);
+	}
+
+	std::string res = format("{\"line\": %lld, \"column\": ", line) +
+	                  (known ? format("%zu", i - start + 1) : "null") +
+	                  format(", \"offset\": %lld, \"context\": [", offset);
+	for (size_t k = 0; k < lines.size(); k++) res += (k ? ", " : "") + lines[k];
+	return res + "]}";
+}
+
+std::string mismatch_context() {
+	return "{\"judge\": " + stream_context(context_ans, judgeans_pos, judgeans_line) +
+	       ",\n \"team\": " + stream_context(context_team, stdin_pos, stdin_line) + "}\n";
+}
+
+/* Skip the longest prefix that is byte-for-byte identical in both inputs and
+ * ends in whitespace (or at the end of both inputs), and add its length and
+ * number of newlines to the counters. Identical tokens and whitespace are
+ * always accepted by the token comparison, so it can continue from there with
+ * the same counters. Most correct output is identical to the answer, so this
+ * usually compares everything at the cost of a memcmp().
+ */
+void skip_identical_prefix(input_stream &a, input_stream &b, long long &nchars, long long &nlines) {
+	const size_t CHUNK = 1 << 14;
+	size_t window = 1 << 20;
+	while (true) {
+		size_t na = a.fill_window(window), nb = b.fill_window(window);
+		size_t n = std::min(na, nb);
+		const char *pa = a.current(), *pb = b.current();
+
+		// Compare in chunks that stay in cache for counting newlines. The
+		// newlines in the first 'counted' bytes are in 'lines'.
+		size_t m = 0, counted = 0, lines = 0;
+		while (m < n) {
+			size_t len = std::min(CHUNK, n - m);
+			if (memcmp(pa + m, pb + m, len) != 0) {
+				while (pa[m] == pb[m]) m++;
+				break;
+			}
+			lines += kernels->count_newlines(pa + m, len);
+			m += len;
+			counted = m;
+		}
+
+		bool done = m < n || (m == na && a.all_read()) || (m == nb && b.all_read());
+		size_t skip = m;
+		if (!(m == na && m == nb && a.all_read() && b.all_read())) {
+			while (skip > 0 && !is_space(pa[skip - 1])) skip--;
+		}
+		if (skip < counted) {
+			lines -= kernels->count_newlines(pa + skip, counted - skip);
+		} else {
+			lines += kernels->count_newlines(pa + counted, skip - counted);
+		}
+
+		a.advance(skip);
+		b.advance(skip);
+		nchars += skip;
+		nlines += lines;
+		if (done) return;
+		// A token longer than the window, read more of it.
+		if (skip == 0) window *= 2;
+	}
+}
+
 bool isfloat(const char *s, flt &val) {
 	char trash[20];
 	flt v;
@@ -56,6 +614,271 @@ bool isfloat(const char *s, flt &val) {
 	return true;
 }
 
+/* Classify a token by a quick scan, without parsing it. DECIMAL_FLOAT tokens
+ * are plain decimal numbers, which isfloat() certainly accepts. Other tokens
+ * can only be floats if they start like one, e.g. "inf" or "0x1p3".
+ */
+enum float_kind { NOT_FLOAT, DECIMAL_FLOAT, MAYBE_FLOAT };
+
+float_kind classify_float(const char *s, size_t n, bool &nonzero) {
+	size_t i = 0, digits = 0;
+	nonzero = false;
+	if (i < n && (s[i] == '+' || s[i] == '-')) i++;
+	for (; i < n && s[i] >= '0' && s[i] <= '9'; i++, digits++) nonzero |= s[i] != '0';
+	if (i < n && s[i] == '.') {
+		for (i++; i < n && s[i] >= '0' && s[i] <= '9'; i++, digits++) nonzero |= s[i] != '0';
+	}
+	if (digits > 0 && i < n && (s[i] == 'e' || s[i] == 'E')) {
+		size_t exp_digits = 0;
+		if (++i < n && (s[i] == '+' || s[i] == '-')) i++;
+		for (; i < n && s[i] >= '0' && s[i] <= '9'; i++) exp_digits++;
+		if (exp_digits == 0) return MAYBE_FLOAT;
+	}
+	if (digits > 0 && i == n) return DECIMAL_FLOAT;
+	return n > 0 && strchr("+-.0123456789iInN", s[0]) ? MAYBE_FLOAT : NOT_FLOAT;
+}
+
+/* A token interpreted as floating point number. Plain decimal numbers are
+ * parsed with std::from_chars into a double, which is locale-independent and
+ * much faster than sscanf(), and usually suffices to decide a comparison.
+ * The long double value of isfloat() is only computed when needed.
+ */
+struct float_token {
+	token_view tok;
+	bool have_double;
+	double dval;
+	bool have_exact;
+	flt val;
+	std::string str;
+
+	/* Returns whether the token is a float according to isfloat(). */
+	bool parse(const token_view &tok_) {
+		tok = tok_;
+		have_double = have_exact = false;
+		bool nonzero;
+		switch (classify_float(tok.data, tok.len, nonzero)) {
+		case NOT_FLOAT:
+			return false;
+		case DECIMAL_FLOAT: {
+			// std::from_chars does not accept a leading '+'.
+			const char *begin = tok.data + (tok.data[0] == '+');
+			std::from_chars_result res = std::from_chars(begin, tok.data + tok.len, dval);
+			// Subnormal values have less precision than we assume later on.
+			have_double = res.ec == std::errc() && res.ptr == tok.data + tok.len &&
+			              (nonzero ? std::isnormal(dval) : dval == 0);
+			return true;
+		}
+		case MAYBE_FLOAT:
+			break;
+		}
+		have_exact = true;
+		return isfloat(str.assign(tok.data, tok.len).c_str(), val);
+	}
+
+	/* Like parse(), but with the results taken from an answer index. */
+	bool parse_indexed(const token_view &tok_, bool is_float, bool have_double_, double dval_) {
+		tok = tok_;
+		have_double = have_double_;
+		dval = dval_;
+		have_exact = false;
+		return is_float;
+	}
+
+	/* The value of the token as computed by isfloat(). */
+	flt exact() {
+		if (!have_exact) {
+			isfloat(str.assign(tok.data, tok.len).c_str(), val);
+			have_exact = true;
+		}
+		return val;
+	}
+};
+
+/* Check whether compare_float() would certainly accept the values, given only
+ * their approximations as doubles. Each double is within a relative error of
+ * 2^-53 of the exact value, and the long double computations in
+ * compare_float() add errors of about 2^-64; we allow a generous margin for
+ * these. If we cannot decide, the values are compared exactly.
+ */
+bool floats_certainly_equal(double jval, double tval, flt float_abs_tol, flt float_rel_tol) {
+	const flt margin = 1.0L / (1ULL << 40);
+	flt absdiff = fabsl((flt)tval - (flt)jval) + (fabsl(jval) + fabsl(tval)) * margin;
+	if (float_abs_tol >= 0 && absdiff <= float_abs_tol * (1 - margin)) return true;
+	if (float_rel_tol >= 0 && jval != 0 && absdiff <= float_rel_tol * fabsl(jval) * (1 - margin)) {
+		return true;
+	}
+	return false;
+}
+
+/* The answer index is a sidecar file '<judge_ans>.idx' with the tokens of the
+ * answer file, generated once per testcase with '--build-index'. With it, the
+ * answer file need not be tokenized and its floats need not be parsed for
+ * every submission. The index holds a header, an entry per token and a
+ * trailer, in native byte order since it never leaves the judgehost. It is
+ * only used for an answer file with the checksum in the header.
+ */
+const char INDEX_MAGIC[8] = { 'D', 'J', 'C', 'M', 'P', 'I', 'D', 'X' };
+const uint32_t INDEX_VERSION = 2;
+
+struct index_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t entry_size;
+	uint64_t checksum;     // Of the contents of the answer file.
+};
+
+enum index_flags {
+	IDX_FLOAT = 1,         // float_token::parse() accepts the token,
+	IDX_DOUBLE = 2,        // and computed 'dval'.
+};
+
+struct index_entry {
+	uint64_t offset;       // Of the token in the answer file.
+	uint32_t len;
+	uint32_t line;
+	uint32_t flags;
+	uint32_t unused;
+	double dval;
+};
+
+struct index_trailer {
+	uint64_t answer_size;
+	uint64_t nlines;       // Line number after the last character.
+	uint64_t ntokens;
+};
+
+/* A checksum of 'len' bytes at 'data', to tell whether an index belongs to
+ * an answer file. It is computed for every use of the index, so it must be
+ * much faster than tokenizing: four independent lanes of multiply and
+ * xorshift keep the multiplier busy.
+ */
+uint64_t answer_checksum(const char *data, size_t len) {
+	const uint64_t prime = 0x9e3779b97f4a7c15ULL;
+	uint64_t h[4] = { len, len ^ 1, len ^ 2, len ^ 3 };
+	size_t i = 0;
+	for (; i + 32 <= len; i += 32) {
+		for (int l = 0; l < 4; l++) {
+			uint64_t w;
+			memcpy(&w, data + i + 8 * l, 8);
+			h[l] = (h[l] ^ w) * prime;
+			h[l] ^= h[l] >> 29;
+		}
+	}
+	uint64_t res = 0;
+	for (int l = 0; l < 4; l++) res = (res ^ h[l]) * prime;
+	for (; i < len; i++) res = (res ^ static_cast<unsigned char>(data[i])) * prime;
+	return res ^ (res >> 32);
+}
+
+/* Write the index of the answer file to stdout. */
+int build_index(const char *answer) {
+	input_stream in;
+	if (!in.open(answer)) judge_error("failed to open %s", answer);
+
+	// The index is only used with a mapped answer file, see main().
+	if (!in.mapped() && !in.all_read()) judge_error("%s is not a regular file", answer);
+
+	index_header hdr;
+	memset(&hdr, 0, sizeof(hdr));
+	memcpy(hdr.magic, INDEX_MAGIC, sizeof(hdr.magic));
+	hdr.version = INDEX_VERSION;
+	hdr.entry_size = sizeof(index_entry);
+	hdr.checksum = answer_checksum(in.map_data(), in.size());
+	fwrite(&hdr, sizeof(hdr), 1, stdout);
+
+	long long pos = 0, line = 1;
+	index_trailer trailer = { 0, 0, 0 };
+	token_view tok;
+	float_token ft;
+	while (true) {
+		in.skip_space(pos, line);
+		if (!in.read_token(tok)) break;
+		index_entry e;
+		memset(&e, 0, sizeof(e));
+		e.offset = pos;
+		e.len = tok.len;
+		e.line = line;
+		if (ft.parse(tok)) {
+			e.flags |= IDX_FLOAT;
+			if (ft.have_double) {
+				e.flags |= IDX_DOUBLE;
+				e.dval = ft.dval;
+			}
+		}
+		fwrite(&e, sizeof(e), 1, stdout);
+		pos += tok.len;
+		trailer.ntokens++;
+	}
+	trailer.answer_size = pos;
+	trailer.nlines = line;
+	fwrite(&trailer, sizeof(trailer), 1, stdout);
+	if (fflush(stdout) != 0 || ferror(stdout)) judge_error("failed to write index: %s", strerror(errno));
+	return 0;
+}
+
+/* A memory-mapped answer index. */
+class answer_index {
+public:
+	answer_index(): map(NULL), map_len(0), entries(NULL), trailer(NULL) {}
+
+	~answer_index() {
+		if (map) munmap(map, map_len);
+	}
+
+	/* Map '<answer>.idx' if it exists and belongs to the answer file with
+	 * contents 'answer_data' of 'answer_size' bytes. Returns false
+	 * otherwise, so that the answer file is tokenized instead.
+	 */
+	bool open(const char *answer, const char *answer_data, size_t answer_size) {
+		std::string path = std::string(answer) + ".idx";
+		int fd = ::open(path.c_str(), O_RDONLY);
+		if (fd < 0) return false;
+		struct stat st;
+		if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) &&
+		    (size_t)st.st_size >= sizeof(index_header) + sizeof(index_trailer)) {
+			map_len = st.st_size;
+			map = mmap(NULL, map_len, PROT_READ, MAP_PRIVATE, fd, 0);
+			if (map == MAP_FAILED) map = NULL;
+		}
+		close(fd);
+		if (!map) return false;
+
+		const char *p = static_cast<const char *>(map);
+		index_header hdr;
+		memcpy(&hdr, p, sizeof(hdr));
+		entries = reinterpret_cast<const index_entry *>(p + sizeof(hdr));
+		trailer = reinterpret_cast<const index_trailer *>(p + map_len - sizeof(index_trailer));
+		if (memcmp(hdr.magic, INDEX_MAGIC, sizeof(hdr.magic)) != 0 ||
+		    hdr.version != INDEX_VERSION || hdr.entry_size != sizeof(index_entry) ||
+		    map_len != sizeof(hdr) + trailer->ntokens * sizeof(index_entry) + sizeof(index_trailer) ||
+		    trailer->answer_size != answer_size ||
+		    hdr.checksum != answer_checksum(answer_data, answer_size)) {
+			munmap(map, map_len);
+			map = NULL;
+			return false;
+		}
+		return true;
+	}
+
+	const index_entry *begin() const { return entries; }
+	const index_entry *end() const { return entries + trailer->ntokens; }
+
+	/* The first token at or after 'offset' in the answer file. */
+	const index_entry *find(size_t offset) const {
+		return std::lower_bound(begin(), end(), offset, [](const index_entry &e, size_t off) {
+			return e.offset < off;
+		});
+	}
+
+	uint64_t nlines() const { return trailer->nlines; }
+
+private:
+	void *map;
+	size_t map_len;
+	const index_entry *entries;
+	const index_trailer *trailer;
+};
+
 template <typename Stream>
 void openfile(Stream &stream, const char *file, const char *whoami) {
 	stream.open(file);
@@ -73,18 +896,14 @@ FILE *openfeedback(const char *feedbackdir, const char *feedback, const char *wh
 	return res;
 }
 
-// The behavior of std::tolower on (signed) char is undefined.
-char tolower_char(char c)
+bool equal_case_sensitive(const token_view &a, const token_view &b)
 {
-    return static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+	return a.len == b.len && memcmp(a.data, b.data, a.len) == 0;
 }
 
-bool equal_case_insensitive(std::string a, std::string b)
+bool equal_case_insensitive(const token_view &a, const token_view &b)
 {
-	for (char &c : a) c = tolower_char(c);
-	for (char &c : b) c = tolower_char(c);
-
-	return a==b;
+	return a.len == b.len && kernels->equal_nocase(a.data, b.data, a.len);
 }
 
 /* Test two floating-point numbers for equality, accounting for +/-INF, NaN, and precision.
@@ -128,16 +947,512 @@ void compare_float(const std::string &judge, const std::string &team, flt jval,
 	}
 }
 
-const char *USAGE = "Usage: %s judge_in judge_ans feedback_dir [options] < team_out";
+/* The note on non-printable characters for a mismatch message. This scans
+ * both tokens, so it is only computed when the tokens mismatch.
+ */
+std::string nonprintable_note(const token_view &judge, const token_view &team) {
+	bool judge_np = !kernels->all_printable(judge.data, judge.len);
+	bool team_np = !kernels->all_printable(team.data, team.len);
+	if (!judge_np && !team_np) return "";
+	return std::string("\nNote: ") + (judge_np ? (team_np ? "judge,team" : "judge") : "team") +
+	       " token contains non-printable characters";
+}
+
+/* Compare the answer and the team output token by token, from the current
+ * positions until the end of the answer. The options are template parameters,
+ * so that every combination of them gets a loop without any tests of the
+ * options; compare_variant() selects one at startup. The tokens of the answer
+ * are taken from 'index' if given, which must be NULL when
+ * space_change_sensitive.
+ */
+template <bool space_change_sensitive, bool use_floats, bool case_sensitive>
+void compare_tokens(input_stream &ans, input_stream &team_out, const answer_index *index,
+                    flt float_abs_tol, flt float_rel_tol) {
+	const index_entry *next_entry = index ? index->find(ans.offset()) : NULL;
+	context_ans = &ans;
+	context_team = &team_out;
+	token_view judge, team;
+	// Reused for all tokens, to avoid an allocation per token.
+	float_token judge_float, team_float;
+	while (true) {
+		// Space!  Can't live with it, can't live without it...
+		if constexpr (space_change_sensitive) {
+			while (std::isspace(static_cast<unsigned char>(ans.peek()))) {
+				char c = (char)ans.get();
+				int d = team_out.get();
+				if (c != d) {
+					wrong_answer("Space change error: got %d expected %d", d, c);
+				}
+				if (d == '\n') ++stdin_line;
+				++stdin_pos;
+				if (c == '\n') ++judgeans_line;
+				++judgeans_pos;
+			}
+			if (std::isspace(static_cast<unsigned char>(team_out.peek()))) {
+				char d = (char)team_out.get();
+				wrong_answer("Space change error: judge out of space, got %d from team", d);
+			}
+		} else {
+			if (!index) ans.skip_space(judgeans_pos, judgeans_line);
+			team_out.skip_space(stdin_pos, stdin_line);
+		}
+
+		const index_entry *entry = NULL;
+		if (index) {
+			if (next_entry == index->end()) {
+				judgeans_pos = ans.size();
+				judgeans_line = index->nlines();
+				break;
+			}
+			entry = next_entry++;
+			judge.data = ans.map_data() + entry->offset;
+			judge.len = entry->len;
+			judgeans_pos = entry->offset;
+			judgeans_line = entry->line;
+		} else if (!ans.read_token(judge)) {
+			break;
+		}
+
+		if (!team_out.read_token(team)) {
+			wrong_answer("User EOF while judge had more output\n(Next judge token: %s)", judge.str().c_str());
+		}
+
+		bool judge_is_float = false;
+		if constexpr (use_floats) {
+			judge_is_float = entry ? judge_float.parse_indexed(judge, entry->flags & IDX_FLOAT,
+			                                                   entry->flags & IDX_DOUBLE, entry->dval)
+			                       : judge_float.parse(judge);
+		}
+		if (judge_is_float) {
+			if (!team_float.parse(team)) {
+				wrong_answer("Expected float, got: %s%s", team.str().c_str(),
+				             nonprintable_note(judge, team).c_str());
+			}
+			if (!judge_float.have_double || !team_float.have_double ||
+			    !floats_certainly_equal(judge_float.dval, team_float.dval, float_abs_tol, float_rel_tol)) {
+				flt jval = judge_float.exact(), tval = team_float.exact();
+				compare_float(judge_float.str, team_float.str, jval, tval,
+				              float_abs_tol, float_rel_tol, nonprintable_note(judge, team));
+			}
+		} else if (!(case_sensitive ? equal_case_sensitive(judge, team) : equal_case_insensitive(judge, team))) {
+			wrong_answer("String tokens mismatch\nJudge: \"%s\"\nTeam: \"%s\"%s",
+			             judge.str().c_str(), team.str().c_str(), nonprintable_note(judge, team).c_str());
+		}
+		judgeans_pos += judge.len;
+		stdin_pos += team.len;
+	}
+}
+
+typedef void (*compare_fn)(input_stream &, input_stream &, const answer_index *, flt, flt);
+
+/* All instances of compare_tokens(), indexed by the options as bits. */
+const compare_fn compare_variants[8] = {
+	compare_tokens<false, false, false>, compare_tokens<false, false, true>,
+	compare_tokens<false, true, false>,  compare_tokens<false, true, true>,
+	compare_tokens<true, false, false>,  compare_tokens<true, false, true>,
+	compare_tokens<true, true, false>,   compare_tokens<true, true, true>,
+};
+
+compare_fn compare_variant(bool space_change_sensitive, bool use_floats, bool case_sensitive) {
+	return compare_variants[space_change_sensitive << 2 | use_floats << 1 | case_sensitive];
+}
+
+/* Comparing outputs of several GB is bound by the memory bandwidth of a
+ * single core, so large outputs are compared in parallel if the cpuset allows.
+ * First both inputs are split into chunks, in which the tokens and newlines
+ * are counted in parallel. Then the token numbers are split into ranges,
+ * which are compared in parallel, each starting at the position and line
+ * numbers that a sequential comparison would be at. The first range with a
+ * mismatch gives the same report as the sequential comparison. The limits
+ * can be overridden at compile time for testing.
+ */
+#ifndef PARALLEL_MIN_SIZE
+#define PARALLEL_MIN_SIZE (64 << 20)
+#endif
+#ifndef PARALLEL_MAX_THREADS
+#define PARALLEL_MAX_THREADS 8
+#endif
+
+int parallel_threads() {
+#ifdef PARALLEL_THREADS
+	return PARALLEL_THREADS;
+#else
+	cpu_set_t set;
+	if (sched_getaffinity(0, sizeof(set), &set) != 0) return 1;
+	return std::min(CPU_COUNT(&set), PARALLEL_MAX_THREADS);
+#endif
+}
+
+/* Run 'work(i)' for i = 0, ..., n-1 on 'nthreads' threads, including the
+ * calling one. Fewer threads are used if they cannot be created.
+ */
+template <typename Work>
+void run_parallel(int nthreads, size_t n, const Work &work) {
+	std::atomic<size_t> next(0);
+	auto worker = [&]() {
+		for (size_t i; (i = next++) < n;) work(i);
+	};
+	std::vector<std::thread> threads;
+	for (int t = 1; t < nthreads; t++) {
+		try {
+			threads.emplace_back(worker);
+		} catch (const std::system_error &) {
+			break;
+		}
+	}
+	worker();
+	for (std::thread &t : threads) t.join();
+}
+
+/* A mapped input from 'base' onward, split into chunks. Tokens belong to the
+ * chunk they start in.
+ */
+struct chunked_input {
+	const char *data;
+	size_t base, size;
+	long long base_line;
+	std::vector<size_t> begin;         // Of each chunk, and 'size' at the end.
+	std::vector<size_t> first_token;   // Start of the first token of each chunk.
+	std::vector<long long> tokens;     // Number of tokens before each chunk.
+	std::vector<long long> lines;      // Number of newlines before each chunk.
+
+	void init(const input_stream &in, long long line, size_t nchunks) {
+		data = in.map_data();
+		base = in.offset();
+		size = in.size();
+		base_line = line;
+		size_t len = std::max<size_t>((size - base) / nchunks, 1);
+		begin.clear();
+		for (size_t b = base; b < size; b += len) begin.push_back(b);
+		begin.push_back(size);
+		nchunks = begin.size() - 1;
+		first_token.assign(nchunks, size);
+		tokens.assign(nchunks + 1, 0);
+		lines.assign(nchunks + 1, 0);
+	}
+
+	size_t nchunks() const { return begin.size() - 1; }
+
+	/* Count tokens and newlines of chunk c, storing them at c+1 for now. */
+	void count(size_t c) {
+		size_t i = begin[c], end = begin[c + 1];
+		// A token continuing from the previous chunk belongs to that.
+		if (i > base && !is_space(data[i - 1])) i += kernels->find_space(data + i, size - i);
+		long long n = 0;
+		while (true) {
+			i += kernels->find_nonspace(data + i, end - std::min(i, end));
+			if (i >= end) break;
+			if (n++ == 0) first_token[c] = i;
+			i += kernels->find_space(data + i, size - i);
+		}
+		tokens[c + 1] = n;
+		lines[c + 1] = kernels->count_newlines(data + begin[c], end - begin[c]);
+	}
+
+	/* Turn the counts per chunk into counts before each chunk. */
+	void sum() {
+		for (size_t c = 0; c < nchunks(); c++) {
+			tokens[c + 1] += tokens[c];
+			lines[c + 1] += lines[c];
+		}
+	}
+
+	long long ntokens() const { return tokens.back(); }
+
+	/* The position and line number of token 'tok', or of the end if there
+	 * is no such token.
+	 */
+	void locate(long long tok, size_t &pos, long long &line) const {
+		if (tok >= ntokens()) {
+			pos = size;
+			line = base_line + lines.back();
+			return;
+		}
+		size_t c = std::upper_bound(tokens.begin(), tokens.end(), tok) - tokens.begin() - 1;
+		pos = first_token[c];
+		for (long long n = tok - tokens[c]; n > 0; n--) {
+			pos += kernels->find_space(data + pos, size - pos);
+			pos += kernels->find_nonspace(data + pos, size - pos);
+		}
+		line = base_line + lines[c] + kernels->count_newlines(data + begin[c], pos - begin[c]);
+	}
+};
+
+/* Compare the mapped inputs 'ans' and 'team_out' from their current
+ * positions like 'compare' would, in parallel. Returns false if the inputs
+ * are not worth it, without consuming any input. Otherwise reports the first
+ * mismatch, or consumes all input up to the end of the answer.
+ */
+bool compare_parallel(compare_fn compare, input_stream &ans, input_stream &team_out,
+                      flt float_abs_tol, flt float_rel_tol) {
+	int nthreads = parallel_threads();
+	if (nthreads < 2 || !ans.mapped() || !team_out.mapped() ||
+	    std::min(ans.size() - ans.offset(), team_out.size() - team_out.offset()) < PARALLEL_MIN_SIZE) {
+		return false;
+	}
+
+	chunked_input a, b;
+	size_t nchunks = 16 * nthreads;
+	a.init(ans, judgeans_line, nchunks);
+	b.init(team_out, stdin_line, nchunks);
+	run_parallel(nthreads, a.nchunks() + b.nchunks(), [&](size_t c) {
+		if (c < a.nchunks()) {
+			a.count(c);
+		} else {
+			b.count(c - a.nchunks());
+		}
+	});
+	a.sum();
+	b.sum();
+
+	// Compare the tokens both inputs have in ranges, and the rest below.
+	long long common = std::min(a.ntokens(), b.ntokens());
+	size_t nranges = std::min<long long>(4 * nthreads, common);
+	std::vector<mismatch> mismatches(nranges);
+	std::atomic<size_t> first_mismatch(nranges);
+	run_parallel(nthreads, nranges, [&](size_t r) {
+		// A range after one with a mismatch does not matter.
+		if (r > first_mismatch) return;
+		long long first = common * r / nranges, last = common * (r + 1) / nranges;
+		size_t apos, bpos, aend;
+		long long aend_line;
+		a.locate(first, apos, judgeans_line);
+		b.locate(first, bpos, stdin_line);
+		a.locate(last, aend, aend_line);
+		judgeans_pos = apos;
+		stdin_pos = bpos;
+
+		// The team output has at least as many tokens, so need not end.
+		input_stream ans_range, team_range;
+		ans_range.open_range(ans, apos, aend);
+		team_range.open_range(team_out, bpos, b.size);
+		throw_mismatch = true;
+		try {
+			compare(ans_range, team_range, NULL, float_abs_tol, float_rel_tol);
+		} catch (const mismatch &m) {
+			mismatches[r] = m;
+			for (size_t cur = first_mismatch; r < cur && !first_mismatch.compare_exchange_weak(cur, r);) {}
+		}
+		throw_mismatch = false;
+	});
+	if (first_mismatch < nranges) report_wrong_answer(mismatches[first_mismatch]);
+
+	// Continue sequentially after the common tokens.
+	size_t apos, bpos;
+	a.locate(common, apos, judgeans_line);
+	b.locate(common, bpos, stdin_line);
+	judgeans_pos = apos;
+	stdin_pos = bpos;
+	ans.advance(apos - ans.offset());
+	team_out.advance(bpos - team_out.offset());
+	compare(ans, team_out, NULL, float_abs_tol, float_rel_tol);
+	return true;
+}
+
+#ifdef COMPARE_SELFTEST
+/* Compiled with -DCOMPARE_SELFTEST, this program checks that all scan
+ * kernels supported by the CPU behave like the C library functions they
+ * replace, on random and adversarial inputs at all alignments, and that the
+ * fast float parsing agrees with isfloat().
+ */
+int selftest_failures = 0;
+
+void check_kernel(bool ok, const char *kernels_name, const char *func, size_t off, size_t n) {
+	if (!ok && selftest_failures++ < 10) {
+		fprintf(stderr, "%s_%s differs at offset %zu, length %zu\n", func, kernels_name, off, n);
+	}
+}
+
+void check_kernels(const scan_kernels *k, const char *a, const char *b, size_t off, size_t n) {
+	const char *s = a + off, *t = b + off;
+	size_t space = 0, nonspace = 0, newlines = 0;
+	bool printable = true, equal = true;
+	while (space < n && !std::isspace(static_cast<unsigned char>(s[space]))) space++;
+	while (nonspace < n && std::isspace(static_cast<unsigned char>(s[nonspace]))) nonspace++;
+	for (size_t i = 0; i < n; i++) {
+		newlines += s[i] == '\n';
+		printable = printable && std::isprint(static_cast<unsigned char>(s[i]));
+		equal = equal && std::tolower(static_cast<unsigned char>(s[i])) ==
+		                 std::tolower(static_cast<unsigned char>(t[i]));
+	}
+	check_kernel(k->find_space(s, n) == space, k->name, "find_space", off, n);
+	check_kernel(k->find_nonspace(s, n) == nonspace, k->name, "find_nonspace", off, n);
+	check_kernel(k->count_newlines(s, n) == newlines, k->name, "count_newlines", off, n);
+	check_kernel(k->all_printable(s, n) == printable, k->name, "all_printable", off, n);
+	check_kernel(k->equal_nocase(s, t, n) == equal, k->name, "equal_nocase", off, n);
+}
+
+void check_float_parsing() {
+	const char alphabet[] = "0123456789.eE+-xXpPinfaINFA()";
+	char buf[16];
+	float_token ft;
+	for (int round = 0; round < 200000; round++) {
+		size_t n = 1 + rand() % 10;
+		for (size_t i = 0; i < n; i++) {
+			// Favour digits, to get many valid numbers.
+			buf[i] = rand() % 2 ? '0' + rand() % 10 : alphabet[rand() % (sizeof(alphabet) - 1)];
+		}
+		buf[n] = '\0';
+		flt exact = 0;
+		bool is_float = isfloat(buf, exact);
+		token_view tok = { buf, n };
+		bool ok = ft.parse(tok) == is_float;
+		if (ok && is_float) {
+			ok = ft.exact() == exact || (std::isnan(exact) && std::isnan(ft.exact()));
+			if (ft.have_double) {
+				ok = ok && fabsl(ft.dval - exact) <= fabsl(exact) * DBL_EPSILON;
+			}
+		}
+		if (!ok && selftest_failures++ < 10) {
+			fprintf(stderr, "float parsing differs for '%s'\n", buf);
+		}
+	}
+	printf("float parsing checked\n");
+}
+
+int main() {
+	check_float_parsing();
+
+	std::vector<const scan_kernels *> all(1, &kernels_scalar);
+#ifdef HAVE_X86_KERNELS
+	if (__builtin_cpu_supports("sse2")) all.push_back(&kernels_sse2);
+	if (__builtin_cpu_supports("avx2")) all.push_back(&kernels_avx2);
+#endif
+	// Characters at the edges of the ranges the kernels test for.
+	const char edges[] = "\x08\t\n\v\f\r\x0e\x1f \x21\x7e\x7f\x80\xff@AZ[`az{";
+	const size_t nedges = sizeof(edges) - 1;
+	const size_t MAXLEN = 200, MAXOFF = 64;
+	std::vector<char> a(MAXOFF + MAXLEN), b(MAXOFF + MAXLEN);
+	srand(42);
+
+	for (size_t k = 0; k < all.size(); k++) {
+		for (int round = 0; round < 2000; round++) {
+			size_t off = rand() % MAXOFF, n = rand() % MAXLEN;
+			for (size_t i = 0; i < a.size(); i++) {
+				a[i] = round % 2 ? rand() % 256 : edges[rand() % nedges];
+				b[i] = a[i];
+			}
+			// Sparse whitespace or non-whitespace, to find matches late.
+			if (round % 4 == 0) {
+				for (size_t i = 0; i < a.size(); i++) a[i] = b[i] = rand() % 64 ? 'x' : ' ';
+			} else if (round % 4 == 2) {
+				for (size_t i = 0; i < a.size(); i++) a[i] = b[i] = rand() % 64 ? '\n' : 'x';
+			}
+			check_kernels(all[k], &a[0], &b[0], off, n);
+			// Change one character in case, or in the bit that the case
+			// of letters differs in.
+			if (n > 0) {
+				size_t i = off + rand() % n;
+				b[i] ^= 0x20;
+				check_kernels(all[k], &a[0], &b[0], off, n);
+				b[i] = std::toupper(static_cast<unsigned char>(a[i]));
+				check_kernels(all[k], &a[0], &b[0], off, n);
+			}
+		}
+		// A single special character at each position.
+		for (size_t n = 0; n <= 70; n++) {
+			for (size_t pos = 0; pos < n; pos++) {
+				for (size_t e = 0; e < nedges; e++) {
+					std::fill(a.begin(), a.end(), 'a');
+					std::fill(b.begin(), b.end(), 'A');
+					a[pos] = edges[e];
+					check_kernels(all[k], &a[0], &b[0], 0, n);
+					std::fill(a.begin(), a.end(), ' ');
+					a[pos] = edges[e];
+					check_kernels(all[k], &a[0], &b[0], 0, n);
+				}
+			}
+		}
+		printf("%s kernels checked\n", all[k]->name);
+	}
+	return selftest_failures ? 1 : 0;
+}
+
+#elif defined(COMPARE_BENCHMARK)
+/* Compiled with -DCOMPARE_BENCHMARK, this program measures the throughput of
+ * every variant of compare_tokens() on generated output of the given number
+ * of MB (default 64), a mix of words, integers and floats. The team output
+ * differs from the answer in case only, for the case insensitive variants.
+ */
+#include <chrono>
+
+std::string write_temp(const std::string &contents) {
+	char path[] = "/tmp/compare_benchmark.XXXXXX";
+	int fd = mkstemp(path);
+	if (fd < 0) judge_error("failed to create temporary file: %s", strerror(errno));
+	for (size_t done = 0; done < contents.size();) {
+		ssize_t n = write(fd, contents.data() + done, contents.size() - done);
+		if (n < 0) judge_error("failed to write temporary file: %s", strerror(errno));
+		done += n;
+	}
+	close(fd);
+	return path;
+}
 
 int main(int argc, char **argv) {
+	judgemessage = stderr;
+	size_t size = (argc > 1 ? atol(argv[1]) : 64) << 20;
+
+	std::string ans, upper;
+	char buf[64];
+	srand(42);
+	while (ans.size() < size) {
+		switch (rand() % 3) {
+		case 0: snprintf(buf, sizeof(buf), "word%d", rand() % 1000); break;
+		case 1: snprintf(buf, sizeof(buf), "%d", rand() - RAND_MAX / 2); break;
+		case 2: snprintf(buf, sizeof(buf), "%.9f", rand() / 1000.0); break;
+		}
+		ans += buf;
+		ans += rand() % 8 ? ' ' : '\n';
+	}
+	upper = ans;
+	for (char &c : upper) c = std::toupper(static_cast<unsigned char>(c));
+	std::string ans_path = write_temp(ans), upper_path = write_temp(upper);
+
+	printf("%s kernels, %zu MB\n", kernels->name, size >> 20);
+	for (int v = 0; v < 8; v++) {
+		bool space_change_sensitive = v & 4, use_floats = v & 2, case_sensitive = v & 1;
+		input_stream a, b;
+		if (!a.open(ans_path.c_str()) || !b.open((case_sensitive ? ans_path : upper_path).c_str())) {
+			judge_error("failed to open temporary files");
+		}
+		judgeans_pos = stdin_pos = 0;
+		judgeans_line = stdin_line = 1;
+
+		auto start = std::chrono::steady_clock::now();
+		compare_variant(space_change_sensitive, use_floats, case_sensitive)(a, b, NULL, 1e-6, 1e-6);
+		std::chrono::duration<double> secs = std::chrono::steady_clock::now() - start;
+		std::string name = std::string(space_change_sensitive ? "space_change_sensitive " : "") +
+		                   (use_floats ? "floats " : "") + (case_sensitive ? "case_sensitive " : "");
+		printf("%-45s %8.1f MB/s\n", name.empty() ? "default" : name.c_str(),
+		       ans.size() / secs.count() / (1 << 20));
+	}
+	unlink(ans_path.c_str());
+	unlink(upper_path.c_str());
+	return 0;
+}
+
+#else
+const char *USAGE = "Usage: %s judge_in judge_ans feedback_dir [options] < team_out\n"
+                    "       %s --build-index judge_ans > judge_ans.idx";
+
+int main(int argc, char **argv) {
+	if (argc == 3 && !strcmp(argv[1], "--build-index")) {
+		return build_index(argv[2]);
+	}
 	if (argc < 4) {
-		judge_error(USAGE, argv[0]);
+		judge_error(USAGE, argv[0], argv[0]);
 	}
 	judgemessage = openfeedback(argv[3], "judgemessage.txt", argv[0]);
 	diffpos = openfeedback(argv[3], "diffposition.txt", argv[0]);
+	diffcontext = openfeedback(argv[3], "diffcontext.json", argv[0]);
 	openfile(judgein, argv[1], argv[0]);
-	openfile(judgeans, argv[2], argv[0]);
+	if (!judgeans.open(argv[2])) {
+		judge_error("%s: failed to open %s\n", argv[0], argv[2]);
+	}
+	if (!team_out.open_fd(STDIN_FILENO)) {
+		judge_error("%s: failed to open standard input\n", argv[0]);
+	}
 
 	bool case_sensitive = false;
 	bool space_change_sensitive = false;
@@ -152,19 +1467,19 @@ int main(int argc, char **argv) {
 			space_change_sensitive = true;
 		} else if (!strcmp(argv[a], "float_absolute_tolerance")) {
 			if (a+1 == argc || !isfloat(argv[a+1], float_abs_tol))
-				judge_error(USAGE, argv[0]);
+				judge_error(USAGE, argv[0], argv[0]);
 			++a;
 		} else if (!strcmp(argv[a], "float_relative_tolerance")) {
 			if (a+1 == argc || !isfloat(argv[a+1], float_rel_tol))
-				judge_error(USAGE, argv[0]);
+				judge_error(USAGE, argv[0], argv[0]);
 			++a;
 		} else if (!strcmp(argv[a], "float_tolerance")) {
 			if (a+1 == argc || !isfloat(argv[a+1], float_rel_tol))
-				judge_error(USAGE, argv[0]);
+				judge_error(USAGE, argv[0], argv[0]);
 			float_abs_tol = float_rel_tol;
 			++a;
 		} else {
-			judge_error(USAGE, argv[0]);
+			judge_error(USAGE, argv[0], argv[0]);
 		}
 	}
 	use_floats = float_abs_tol >= 0 || float_rel_tol >= 0;
@@ -172,83 +1487,26 @@ int main(int argc, char **argv) {
 	judgeans_pos = stdin_pos;
 	judgeans_line = stdin_line = 1;
 
-	std::string judge, team;
-	while (true) {
-		// Space!  Can't live with it, can't live without it...
-		while (std::isspace(static_cast<unsigned char>(judgeans.peek()))) {
-			char c = (char)judgeans.get();
-			if (space_change_sensitive) {
-				int d = std::cin.get();
-				if (c != d) {
-					wrong_answer("Space change error: got %d expected %d", d, c);
-				}
-				if (d == '\n') ++stdin_line;
-				++stdin_pos;
-			}
-			if (c == '\n') ++judgeans_line;
-			++judgeans_pos;
-		}
-		while (std::isspace(static_cast<unsigned char>(std::cin.peek()))) {
-			char d = (char)std::cin.get();
-			if (space_change_sensitive) {
-				wrong_answer("Space change error: judge out of space, got %d from team", d);
-			}
-			if (d == '\n') ++stdin_line;
-			++stdin_pos;
-		}
-
-		if (!(judgeans >> judge))
-			break;
-
-		if (!(std::cin >> team)) {
-			wrong_answer("User EOF while judge had more output\n(Next judge token: %s)", judge.c_str());
-		}
+	skip_identical_prefix(judgeans, team_out, judgeans_pos, judgeans_line);
+	stdin_pos = judgeans_pos;
+	stdin_line = judgeans_line;
 
-		std::string extra_msg = "";
-		bool nonprintable = false;
-		for (char c : judge) {
-			if (!std::isprint(static_cast<unsigned char>(c))) {
-				nonprintable = true;
-				extra_msg += "judge";
-				break;
-			}
-		}
-		for (char c : team) {
-			if (!std::isprint(static_cast<unsigned char>(c))) {
-				if (nonprintable) extra_msg += ',';
-				nonprintable = true;
-				extra_msg += "team";
-				break;
-			}
-		}
-		if (nonprintable) {
-			extra_msg = "\nNote: " + extra_msg + " token contains non-printable characters";
-		}
+	// The index only has the tokens, not the whitespace between them.
+	answer_index index;
+	bool use_index = !space_change_sensitive && judgeans.mapped() &&
+	                 index.open(argv[2], judgeans.map_data(), judgeans.size());
 
-		flt jval, tval;
-		if (use_floats && isfloat(judge.c_str(), jval)) {
-			if (!isfloat(team.c_str(), tval)) {
-				wrong_answer("Expected float, got: %s%s", team.c_str(), extra_msg.c_str());
-			}
-			compare_float(judge, team, jval, tval, float_abs_tol, float_rel_tol, extra_msg);
-		} else if (case_sensitive) {
-			if (judge != team) {
-				wrong_answer("String tokens mismatch\nJudge: \"%s\"\nTeam: \"%s\"%s",
-				             judge.c_str(), team.c_str(), extra_msg.c_str());
-			}
-		} else {
-			if (!equal_case_insensitive(judge, team)) {
-				wrong_answer("String tokens mismatch\nJudge: \"%s\"\nTeam: \"%s\"%s",
-				             judge.c_str(), team.c_str(), extra_msg.c_str());
-			}
-		}
-		judgeans_pos += judge.length();
-		stdin_pos += team.length();
+	compare_fn compare = compare_variant(space_change_sensitive, use_floats, case_sensitive);
+	if (use_index || space_change_sensitive ||
+	    !compare_parallel(compare, judgeans, team_out, float_abs_tol, float_rel_tol)) {
+		compare(judgeans, team_out, use_index ? &index : NULL, float_abs_tol, float_rel_tol);
 	}
 
-	if (std::cin >> team) {
-		wrong_answer("Trailing output:\n%s", team.c_str());
+	token_view team;
+	if (team_out.read_token(team)) {
+		wrong_answer("Trailing output:\n%s", team.str().c_str());
 	}
 
 	exit(EXIT_AC);
 }
+#endif